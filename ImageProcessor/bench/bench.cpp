@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+#include "Image.h"
+#include "Pipeline.h"
+#include "Scratch.h"
+
+// Every allocation made while an operation runs is counted, so the report can
+// show how many bytes each call asks the allocator for.
+static std::atomic<size_t> allocated_bytes(0);
+
+void* operator new(size_t size)
+{
+	allocated_bytes += size;
+	void* p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	allocated_bytes += size;
+	return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// Pixel buffers use the aligned forms
+static void* aligned_allocate(size_t size, std::align_val_t alignment)
+{
+	allocated_bytes += size;
+#ifdef _WIN32
+	return _aligned_malloc(size ? size : 1, (size_t)alignment);
+#else
+	void* p = nullptr;
+	return posix_memalign(&p, (size_t)alignment, size ? size : 1) == 0 ? p : nullptr;
+#endif
+}
+
+static void aligned_release(void* p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	void* p = aligned_allocate(size, alignment);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return aligned_allocate(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return aligned_allocate(size, alignment);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept { aligned_release(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { aligned_release(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { aligned_release(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { aligned_release(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { aligned_release(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { aligned_release(p); }
+
+using Clock = std::chrono::steady_clock;
+
+// Encoding operations store the size of their output here, so the report can
+// weigh each encoder preset's speed against the bytes it writes
+static size_t encoded_bytes = 0;
+
+struct Operation
+{
+	std::string name;
+	bool needs_color;
+	std::function<void(Image&)> run;
+};
+
+struct Size
+{
+	std::string name;
+	int width;
+	int height;
+};
+
+struct Result
+{
+	std::string op;
+	std::string size;
+	int width;
+	int height;
+	int channels;
+	int iterations;
+	double median_ms;
+	double min_ms;
+	double mpix_per_s;
+	double bytes_per_op;
+	size_t encoded_bytes;
+	size_t scratch_bytes;
+};
+
+struct Options
+{
+	const char* image = nullptr;
+	const char* json = nullptr;
+	const char* filter = nullptr;
+	int min_iterations = 3;
+	double min_seconds = 0.25;
+	bool quick = false;
+};
+
+static std::vector<Operation> make_operations()
+{
+	std::vector<Operation> ops = {
+		{ "flipX", false, [](Image& img) { img.flipX(); } },
+		{ "flipY", false, [](Image& img) { img.flipY(); } },
+		{ "flipX_to", false, [](Image& img) { static Image target(0, 0, 0); img.flipX_to(target); } },
+		{ "flipY_to", false, [](Image& img) { static Image target(0, 0, 0); img.flipY_to(target); } },
+		{ "rotate90", false, [](Image& img) { img.rotate90(); } },
+		{ "rotate180", false, [](Image& img) { img.rotate180(); } },
+		{ "rotate270", false, [](Image& img) { img.rotate270(); } },
+		{ "transpose", false, [](Image& img) { img.transpose(); } },
+		{ "crop", false, [](Image& img) { img.crop(img.width / 4, img.height / 4, img.height / 2, img.width / 2); } },
+		{ "resize", false, [](Image& img) { img.resize(img.width / 2, img.height / 2); } },
+		{ "resize_bilinear", false, [](Image& img) { img.resize(img.width / 3, img.height / 3, BILINEAR); } },
+		{ "resize_bicubic", false, [](Image& img) { img.resize(img.width / 3, img.height / 3, BICUBIC); } },
+		{ "resize_lanczos3", false, [](Image& img) { img.resize(img.width / 3, img.height / 3, LANCZOS3); } },
+		{ "thumbnail", false, [](Image& img) { img.resize(256, 256 * img.height / img.width, LANCZOS3); } },
+		{ "scale", false, [](Image& img) { img.scale(0.75); } },
+		{ "grayscale_avg", true, [](Image& img) { img.grayscale_avg(); } },
+		{ "grayscale_lum", true, [](Image& img) { img.grayscale_lum(); } },
+		{ "color_mask", true, [](Image& img) { img.color_mask(1.0f, 0.5f, 0.25f); } },
+		{ "pixelize", false, [](Image& img) { img.pixelize(8); } },
+		{ "pixelize_region", false, [](Image& img) { img.crop_view(img.width / 4, img.height / 4, 256, 256).pixelize(16); } },
+	};
+
+	for (int strength = 1; strength <= 4; ++strength)
+	{
+		ops.push_back({ "gaussian_blur_" + std::to_string(strength), false, [strength](Image& img) { img.gaussian_blur(strength); } });
+	}
+
+	ops.push_back({ "edge_detection", true, [](Image& img) { img.edge_detection(); } });
+	ops.push_back({ "sharpen", false, [](Image& img) { img.sharpen(); } });
+
+	// The same multi-step recipe run eagerly and through a fused Pipeline
+	ops.push_back({ "recipe_eager", true, [](Image& img) { img.grayscale_lum().color_mask(1.0f, 0.8f, 0.6f).gaussian_blur(2).sharpen(); } });
+	ops.push_back({ "recipe_pipeline", true, [](Image& img)
+	{
+		static const Pipeline recipe = Pipeline().grayscale_lum().color_mask(1.0f, 0.8f, 0.6f).gaussian_blur(2).sharpen();
+		recipe.apply(img);
+	} });
+
+	// Each encoder preset on each format, reporting time and output size
+	struct Preset
+	{
+		const char* name;
+		WriteOptions options;
+	};
+	struct Format
+	{
+		const char* name;
+		ImageType type;
+	};
+
+	static const Preset presets[] = { { "default", WriteOptions() }, { "fastest", WriteOptions::fastest() },
+		{ "balanced", WriteOptions::balanced() }, { "smallest", WriteOptions::smallest() } };
+	static const Format formats[] = { { "png", PNG }, { "jpg", JPG }, { "tga", TGA } };
+
+	for (const Format& format : formats)
+	{
+		for (const Preset& preset : presets)
+		{
+			ImageType type = format.type;
+			WriteOptions options = preset.options;
+			ops.push_back({ std::string("encode_") + format.name + "_" + preset.name, false, [type, options](Image& img)
+			{
+				encoded_bytes = img.encode(type, options).size();
+			} });
+		}
+	}
+
+	return ops;
+}
+
+// Deterministic gradient plus noise, used when no source photo is available
+static Image make_synthetic(int width, int height)
+{
+	Image img(width, height, 3);
+	uint32_t state = 2463534242u;
+
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+
+			uint8_t* px = &img.data[(y * width + x) * 3];
+			px[0] = (x * 255 / width + (state & 31)) & 0xFF;
+			px[1] = (y * 255 / height + ((state >> 8) & 31)) & 0xFF;
+			px[2] = ((x + y) * 127 / (width + height) + ((state >> 16) & 63)) & 0xFF;
+		}
+	}
+
+	return img;
+}
+
+static Image with_channels(const Image& src, int channels)
+{
+	Image img(src.width, src.height, channels);
+	size_t pixels = (size_t)src.width * src.height;
+
+	for (size_t i = 0; i < pixels; ++i)
+	{
+		const uint8_t* s = &src.data[i * src.channels];
+		uint8_t* d = &img.data[i * channels];
+
+		if (channels < 3)
+		{
+			d[0] = (s[0] + s[1] + s[2]) / 3;
+		}
+		else
+		{
+			memcpy(d, s, 3);
+		}
+
+		if (channels == 2 || channels == 4)
+			d[channels - 1] = 255;
+	}
+
+	return img;
+}
+
+static Image make_source(const Options& options, const Size& size)
+{
+	if (options.image)
+	{
+		Image photo(options.image);
+		if (photo.is_valid() && photo.channels >= 3)
+		{
+			photo.resize(size.width, size.height);
+			return with_channels(photo, 3);
+		}
+	}
+
+	return make_synthetic(size.width, size.height);
+}
+
+static Result run_case(const Operation& op, const Size& size, const Image& source, const Options& options)
+{
+	std::vector<double> times;
+	size_t total_bytes = 0;
+	double elapsed = 0;
+	scratch_reset_high_water();
+
+	while ((int)times.size() < options.min_iterations || elapsed < options.min_seconds)
+	{
+		Image work(source);
+		encoded_bytes = 0;
+
+		size_t before = allocated_bytes.load();
+		Clock::time_point start = Clock::now();
+		op.run(work);
+		Clock::time_point end = Clock::now();
+		total_bytes += allocated_bytes.load() - before;
+
+		double seconds = std::chrono::duration<double>(end - start).count();
+		times.push_back(seconds * 1000.0);
+		elapsed += seconds;
+	}
+
+	std::vector<double> sorted = times;
+	std::sort(sorted.begin(), sorted.end());
+
+	Result result;
+	result.op = op.name;
+	result.size = size.name;
+	result.width = source.width;
+	result.height = source.height;
+	result.channels = source.channels;
+	result.iterations = (int)times.size();
+	result.median_ms = sorted[sorted.size() / 2];
+	result.min_ms = sorted.front();
+	result.mpix_per_s = (double)source.width * source.height / 1e6 / (result.median_ms / 1000.0);
+	result.bytes_per_op = (double)total_bytes / times.size();
+	result.encoded_bytes = encoded_bytes;
+	result.scratch_bytes = scratch_stats().high_water;
+	return result;
+}
+
+static bool write_json(const char* filename, const std::vector<Result>& results)
+{
+	FILE* f = fopen(filename, "w");
+	if (!f) return false;
+
+	fprintf(f, "{\n  \"benchmark\": \"image_bench\",\n  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& r = results[i];
+		fprintf(f, "    {\"op\": \"%s\", \"size\": \"%s\", \"width\": %d, \"height\": %d, \"channels\": %d, "
+			"\"iterations\": %d, \"median_ms\": %.4f, \"min_ms\": %.4f, \"mpix_per_s\": %.3f, \"bytes_allocated_per_op\": %.0f, \"encoded_bytes\": %zu, \"scratch_bytes\": %zu}%s\n",
+			r.op.c_str(), r.size.c_str(), r.width, r.height, r.channels,
+			r.iterations, r.median_ms, r.min_ms, r.mpix_per_s, r.bytes_per_op, r.encoded_bytes, r.scratch_bytes,
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+
+	fclose(f);
+	return true;
+}
+
+static void print_usage()
+{
+	printf("Usage: image_bench [options]\n"
+		"  --image <file>    source photo, resized to each benchmark size (default: Images/flower.jpg)\n"
+		"  --json <file>     write machine-readable results to <file>\n"
+		"  --filter <text>   only run operations whose name contains <text>\n"
+		"  --iterations <n>  minimum iterations per case (default: 3)\n"
+		"  --min-time <s>    minimum measured seconds per case (default: 0.25)\n"
+		"  --quick           skip the full-size 4928x3264 frame\n");
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--image" && has_value)
+			options.image = argv[++i];
+		else if (arg == "--json" && has_value)
+			options.json = argv[++i];
+		else if (arg == "--filter" && has_value)
+			options.filter = argv[++i];
+		else if (arg == "--iterations" && has_value)
+			options.min_iterations = std::max(1, atoi(argv[++i]));
+		else if (arg == "--min-time" && has_value)
+			options.min_seconds = atof(argv[++i]);
+		else if (arg == "--quick")
+			options.quick = true;
+		else
+		{
+			print_usage();
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+
+	if (!options.image)
+	{
+		const char* candidates[] = { "Images/flower.jpg", "../Images/flower.jpg", "../../Images/flower.jpg" };
+		for (const char* candidate : candidates)
+		{
+			if (FILE* f = fopen(candidate, "rb"))
+			{
+				fclose(f);
+				options.image = candidate;
+				break;
+			}
+		}
+	}
+
+	std::vector<Size> sizes = {
+		{ "vga", 640, 480 },
+		{ "1080p", 1920, 1080 },
+		{ "16mp", 4928, 3264 },
+	};
+	if (options.quick)
+		sizes.pop_back();
+
+	int channel_counts[] = { 1, 3, 4 };
+	std::vector<Operation> ops = make_operations();
+	std::vector<Result> results;
+
+	printf("%-20s %-6s %10s %3s %6s %11s %11s %10s %14s %12s %12s\n",
+		"op", "size", "dims", "ch", "iters", "median ms", "min ms", "MP/s", "bytes/op", "scratch", "encoded");
+
+	for (const Size& size : sizes)
+	{
+		Image base = make_source(options, size);
+
+		for (int channels : channel_counts)
+		{
+			Image source = with_channels(base, channels);
+
+			for (const Operation& op : ops)
+			{
+				if (op.needs_color && channels < 3) continue;
+				if (options.filter && op.name.find(options.filter) == std::string::npos) continue;
+
+				Result r = run_case(op, size, source, options);
+				results.push_back(r);
+
+				char dims[32];
+				snprintf(dims, sizeof(dims), "%dx%d", r.width, r.height);
+				char encoded[32] = "-";
+				if (r.encoded_bytes)
+					snprintf(encoded, sizeof(encoded), "%zu", r.encoded_bytes);
+				printf("%-20s %-6s %10s %3d %6d %11.3f %11.3f %10.1f %14.0f %12zu %12s\n",
+					r.op.c_str(), r.size.c_str(), dims, r.channels, r.iterations,
+					r.median_ms, r.min_ms, r.mpix_per_s, r.bytes_per_op, r.scratch_bytes, encoded);
+				fflush(stdout);
+			}
+		}
+	}
+
+	if (options.json)
+	{
+		if (!write_json(options.json, results))
+		{
+			printf("Failed to write %s\n", options.json);
+			return 1;
+		}
+		printf("Results written to %s\n", options.json);
+	}
+
+	return 0;
+}
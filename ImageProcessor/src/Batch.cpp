@@ -0,0 +1,428 @@
+#include "Batch.h"
+#include "Stream.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+
+namespace fs = std::filesystem;
+using namespace std;
+
+
+static bool is_image_extension(const fs::path& path)
+{
+	std::string ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+
+	return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" || ext == ".tga";
+}
+
+static std::string output_path(const fs::path& output_dir, fs::path relative, const std::string& extension)
+{
+	if (!extension.empty())
+	{
+		relative.replace_extension(extension);
+	}
+
+	return (output_dir / relative).string();
+}
+
+bool plan_batch(const std::vector<std::string>& inputs, const std::string& output_dir, const std::string& extension, bool recursive, std::vector<BatchItem>& items, std::string& error)
+{
+	std::error_code ec;
+
+	for (const std::string& input : inputs)
+	{
+		fs::path path(input);
+
+		if (fs::is_directory(path, ec))
+		{
+			std::vector<fs::path> found;
+			auto add = [&](const fs::directory_entry& entry)
+			{
+				if (entry.is_regular_file(ec) && is_image_extension(entry.path()))
+					found.push_back(entry.path());
+			};
+
+			if (recursive)
+			{
+				for (const fs::directory_entry& entry : fs::recursive_directory_iterator(path, ec))
+					add(entry);
+			}
+			else
+			{
+				for (const fs::directory_entry& entry : fs::directory_iterator(path, ec))
+					add(entry);
+			}
+
+			// Directory order is unspecified, so sort for reproducible runs
+			std::sort(found.begin(), found.end());
+			for (const fs::path& file : found)
+			{
+				items.push_back({ file.string(), output_path(output_dir, file.lexically_relative(path), extension) });
+			}
+		}
+		else if (fs::exists(path, ec))
+		{
+			items.push_back({ input, output_path(output_dir, path.filename(), extension) });
+		}
+		else
+		{
+			error = "No such file or directory: " + input;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point since)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+static void create_parent(const std::string& output)
+{
+	std::error_code ec;
+	fs::path parent = fs::path(output).parent_path();
+	if (!parent.empty())
+	{
+		fs::create_directories(parent, ec);
+	}
+}
+
+static BatchFileResult stream_file(const BatchItem& item, const Pipeline& pipeline, int strip_rows, uint64_t& pixels)
+{
+	BatchFileResult result;
+	result.item = &item;
+
+	auto start = std::chrono::steady_clock::now();
+	StreamReader reader;
+	if (!reader.open(item.input.c_str(), result.message))
+	{
+		result.error = "read";
+		return result;
+	}
+	result.width = reader.width();
+	result.height = reader.height();
+	pixels = (uint64_t)result.width * result.height;
+
+	create_parent(item.output);
+	if (!stream_image(reader, item.output.c_str(), pipeline, result.message, strip_rows))
+	{
+		result.error = "write";
+		return result;
+	}
+	result.process_ms = elapsed_ms(start);
+
+	result.ok = true;
+	return result;
+}
+
+// Runs stream_file, reporting a file that runs out of memory as failed
+static BatchFileResult stream_file_checked(const BatchItem& item, const Pipeline& pipeline, int strip_rows, uint64_t& pixels)
+{
+	try
+	{
+		return stream_file(item, pipeline, strip_rows, pixels);
+	}
+	catch (const std::bad_alloc&)
+	{
+		BatchFileResult result;
+		result.item = &item;
+		result.error = "process";
+		result.message = "out of memory";
+		return result;
+	}
+}
+
+// Blocking FIFO holding at most `capacity` items, so a fast stage waits for
+// a slow one instead of filling memory with decoded images
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+
+	void push(T&& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [&]() { return items.size() < capacity; });
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+	}
+
+	// Waits for the next item. Returns false once the queue is closed and empty
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [&]() { return !items.empty() || closed; });
+		if (items.empty()) return false;
+
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	// No more items will be pushed
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_empty.notify_all();
+	}
+
+private:
+	size_t capacity;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	bool closed = false;
+};
+
+// Counts the images between decoding and writing, making decoders wait once
+// `capacity` are in flight
+class FrameSlots
+{
+public:
+	explicit FrameSlots(size_t capacity) : available(std::max<size_t>(1, capacity)) {}
+
+	void acquire()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		freed.wait(lock, [&]() { return available > 0; });
+		--available;
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++available;
+		freed.notify_one();
+	}
+
+private:
+	size_t available;
+	std::mutex mutex;
+	std::condition_variable freed;
+};
+
+// A file on its way through the decode, process and encode stages
+struct BatchWork
+{
+	BatchFileResult result;
+	Image img = Image(0, 0, 0);
+	uint64_t pixels = 0;
+};
+
+// Marks the file as failed at `step` after running out of memory, and frees its pixels
+static bool out_of_memory(BatchWork& work, const char* step)
+{
+	work.img = Image(0, 0, 0);
+	work.result.error = step;
+	work.result.message = "out of memory";
+	return false;
+}
+
+static bool decode_file(BatchWork& work, const ReadOptions& read_options)
+{
+	auto start = std::chrono::steady_clock::now();
+	try
+	{
+		if (!work.img.read(work.result.item->input.c_str(), read_options))
+		{
+			work.result.error = "read";
+			return false;
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		return out_of_memory(work, "read");
+	}
+	work.result.read_ms = elapsed_ms(start);
+	work.pixels = (uint64_t)work.img.width * work.img.height;
+	return true;
+}
+
+static bool transform_file(BatchWork& work, const Pipeline& pipeline)
+{
+	auto start = std::chrono::steady_clock::now();
+	try
+	{
+		pipeline.apply(work.img);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return out_of_memory(work, "process");
+	}
+	work.result.process_ms = elapsed_ms(start);
+	work.result.width = work.img.width;
+	work.result.height = work.img.height;
+	return true;
+}
+
+static bool encode_file(BatchWork& work, const WriteOptions& write_options)
+{
+	auto start = std::chrono::steady_clock::now();
+	try
+	{
+		create_parent(work.result.item->output);
+		if (!work.img.write(work.result.item->output.c_str(), write_options))
+		{
+			work.img = Image(0, 0, 0);
+			work.result.error = "write";
+			return false;
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		return out_of_memory(work, "write");
+	}
+	work.result.write_ms = elapsed_ms(start);
+
+	// Free the pixels before the report, which may wait for the lock
+	work.img = Image(0, 0, 0);
+	work.result.ok = true;
+	return true;
+}
+
+BatchSummary run_batch(const std::vector<BatchItem>& items, const Pipeline& pipeline, const BatchOptions& options, const std::function<void(const BatchFileResult&)>& on_file)
+{
+	int jobs = options.jobs;
+	if (jobs <= 0)
+	{
+		jobs = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	jobs = std::max(1, std::min(jobs, (int)items.size()));
+
+	// Decoding and encoding only need to keep the processing workers fed
+	int io_jobs = options.io_jobs > 0 ? options.io_jobs : std::max(1, jobs / 2);
+	io_jobs = std::max(1, std::min(io_jobs, (int)items.size()));
+
+	BatchSummary summary;
+	summary.files = (int)items.size();
+
+	std::atomic<size_t> next(0);
+	std::mutex report_mutex;
+	auto start = std::chrono::steady_clock::now();
+
+	auto report = [&](const BatchFileResult& result, uint64_t pixels)
+	{
+		std::lock_guard<std::mutex> lock(report_mutex);
+		if (result.ok)
+			summary.pixels += pixels;
+		else
+			summary.failed++;
+
+		if (on_file)
+			on_file(result);
+	};
+
+	// Each of `workers` threads runs `body` and the last one to finish calls `done`
+	std::vector<std::thread> threads;
+	auto start_stage = [&](int workers, const std::function<void()>& body, const std::function<void()>& done)
+	{
+		auto remaining = std::make_shared<std::atomic<int>>(workers);
+		for (int i = 0; i < workers; ++i)
+		{
+			threads.emplace_back([=]()
+			{
+				body();
+				if (--*remaining == 0 && done)
+					done();
+			});
+		}
+	};
+
+	// Images waiting between the decode and process stages and between the
+	// process and encode stages. Decoders also wait for a slot, so however many
+	// workers each stage has, at most `in_flight` decoded images exist at once
+	size_t depth = options.queue_depth > 0 ? options.queue_depth : 1;
+	BoundedQueue<BatchWork> decoded(depth);
+	BoundedQueue<BatchWork> processed(depth);
+	FrameSlots in_flight(options.max_in_flight > 0 ? options.max_in_flight : jobs + 2);
+
+	if (options.stream)
+	{
+		// Streamed files are read, processed and written in one go. Each job
+		// takes the next unclaimed file, so slow files do not hold up the rest
+		start_stage(jobs, [&]()
+		{
+			for (size_t i = next++; i < items.size(); i = next++)
+			{
+				uint64_t pixels = 0;
+				BatchFileResult result = stream_file_checked(items[i], pipeline, options.strip_rows, pixels);
+				report(result, pixels);
+			}
+		}, nullptr);
+	}
+	else
+	{
+		// Decoding, processing and encoding run on their own workers, so
+		// consecutive files overlap: while one file is filtered, the next is
+		// decoded and the previous one encoded
+		start_stage(io_jobs, [&]()
+		{
+			for (size_t i = next++; i < items.size(); i = next++)
+			{
+				BatchWork work;
+				work.result.item = &items[i];
+				in_flight.acquire();
+				if (decode_file(work, options.read))
+				{
+					decoded.push(std::move(work));
+				}
+				else
+				{
+					in_flight.release();
+					report(work.result, 0);
+				}
+			}
+		}, [&]() { decoded.close(); });
+
+		start_stage(jobs, [&]()
+		{
+			BatchWork work;
+			while (decoded.pop(work))
+			{
+				if (transform_file(work, pipeline))
+				{
+					processed.push(std::move(work));
+				}
+				else
+				{
+					in_flight.release();
+					report(work.result, 0);
+				}
+			}
+		}, [&]() { processed.close(); });
+
+		start_stage(io_jobs, [&]()
+		{
+			BatchWork work;
+			while (processed.pop(work))
+			{
+				encode_file(work, options.write);
+				in_flight.release();
+				report(work.result, work.pixels);
+			}
+		}, nullptr);
+	}
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	summary.seconds = elapsed_ms(start) / 1000;
+	return summary;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Pipeline.h"
+
+// One file of a batch and where its result is written
+struct BatchItem
+{
+	std::string input;
+	std::string output;
+};
+
+struct BatchFileResult
+{
+	const BatchItem* item = nullptr;
+	bool ok = false;
+	const char* error = nullptr; // Step that failed when !ok
+	std::string message;         // Why it failed, when known
+	int width = 0;               // Size of the written image
+	int height = 0;
+	double read_ms = 0;
+	double process_ms = 0;
+	double write_ms = 0;
+};
+
+struct BatchSummary
+{
+	int files = 0;
+	int failed = 0;
+	uint64_t pixels = 0; // Pixels decoded from all successful inputs
+	double seconds = 0;
+};
+
+// Lists the images to process. Directories contribute the files they contain
+// with a known image extension (recursively if asked), and keep their layout
+// below output_dir. An empty `extension` keeps each input's own format.
+// Returns false and sets `error` if an input does not exist.
+bool plan_batch(const std::vector<std::string>& inputs, const std::string& output_dir, const std::string& extension, bool recursive, std::vector<BatchItem>& items, std::string& error);
+
+struct BatchOptions
+{
+	int jobs = 0;          // Files processed at once (0 = one per hardware thread)
+	int io_jobs = 0;       // Workers in each of the decode and encode stages (0 = half of jobs, at least 1)
+	int queue_depth = 0;   // Images held between two stages (0 = 1)
+	int max_in_flight = 0; // Images decoded but not yet written, which bounds memory use (0 = jobs + 2)
+	ReadOptions read;
+	WriteOptions write;   // Encoder settings; streamed files are written uncompressed
+	bool stream = false;  // Process files a strip at a time with stream_image
+	int strip_rows = 256; // Rows per strip when streaming
+};
+
+// Reads, processes and writes every item, calling on_file as each file
+// completes. Decoding, processing and encoding run as three stages with their
+// own workers and bounded queues between them, so one file can be decoded
+// while the previous one is filtered and the one before that encoded. on_file
+// calls are serialized, so it may print without locking. A file that runs out
+// of memory in any stage is reported as failed, and the batch carries on.
+// Streamed files report all their time as processing, since reading and
+// writing are interleaved with it, and ignore the read options.
+BatchSummary run_batch(const std::vector<BatchItem>& items, const Pipeline& pipeline, const BatchOptions& options, const std::function<void(const BatchFileResult&)>& on_file);
@@ -0,0 +1,223 @@
+#include "Flip.h"
+#include "Simd.h"
+#include <cstring>
+
+// Pixels reversed per step by the vector kernels: `channels` 16-byte blocks
+static const int GROUP = 16;
+
+template <int C>
+static void flip_row_scalar(uint8_t* left, uint8_t* right)
+{
+	// left and right point at the outermost pixels still to swap
+	uint8_t temp[C];
+	for (; left < right; left += C, right -= C)
+	{
+		memcpy(temp, left, C);
+		memcpy(left, right, C);
+		memcpy(right, temp, C);
+	}
+}
+
+template <int C>
+static void copy_reversed_scalar(const uint8_t* src_last, uint8_t* dst, int count)
+{
+	for (int x = 0; x < count; ++x)
+	{
+		memcpy(dst + x * C, src_last - x * C, C);
+	}
+}
+
+// Dispatches to the kernel specialized for the channel count
+template <template <int> class Kernel, typename... Args>
+static void with_channels(int channels, Args... args)
+{
+	switch (channels)
+	{
+	case 1: Kernel<1>::run(args...); break;
+	case 2: Kernel<2>::run(args...); break;
+	case 3: Kernel<3>::run(args...); break;
+	case 4: Kernel<4>::run(args...); break;
+	}
+}
+
+template <int C>
+struct FlipScalar
+{
+	static void run(uint8_t* row, int begin, int end)
+	{
+		// Swaps pixels [begin, end) end for end
+		if (end - begin > 1)
+			flip_row_scalar<C>(row + begin * C, row + (end - 1) * C);
+	}
+};
+
+template <int C>
+struct CopyScalar
+{
+	static void run(const uint8_t* src, uint8_t* dst, int width, int begin, int end)
+	{
+		// Writes dst pixels [begin, end)
+		copy_reversed_scalar<C>(src + (width - 1 - begin) * C, dst + begin * C, end - begin);
+	}
+};
+
+#if IP_X86
+
+// shuffle[j][b] moves the bytes of input block b that belong in output block j
+// of a reversed group to their lanes and zeroes the rest, so output block j is
+// the OR of the shuffles of every input block. With 1, 2 or 4 channels only
+// block C - 1 - j contributes; RGB pixels straddle block boundaries.
+struct FlipTable
+{
+	alignas(16) uint8_t shuffle[4][4][16];
+};
+
+static FlipTable make_flip_table(int channels)
+{
+	FlipTable table;
+
+	for (int j = 0; j < channels; ++j)
+	{
+		for (int b = 0; b < channels; ++b)
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				int out = j * 16 + i;
+				int src = (GROUP - 1 - out / channels) * channels + out % channels;
+				table.shuffle[j][b][i] = src / 16 == b ? (uint8_t)(src % 16) : 0x80;
+			}
+		}
+	}
+
+	return table;
+}
+
+template <int C>
+static const FlipTable& flip_table()
+{
+	static const FlipTable table = make_flip_table(C);
+	return table;
+}
+
+template <int C>
+IP_TARGET_SSE41 static inline void reverse_group(const __m128i* in, __m128i* out, const FlipTable& table)
+{
+	for (int j = 0; j < C; ++j)
+	{
+		if (C != 3)
+		{
+			// Whole pixels per block, so each output block is one input block reversed
+			out[j] = _mm_shuffle_epi8(in[C - 1 - j], _mm_load_si128((const __m128i*)table.shuffle[j][C - 1 - j]));
+			continue;
+		}
+
+		__m128i result = _mm_setzero_si128();
+		for (int b = 0; b < C; ++b)
+		{
+			result = _mm_or_si128(result, _mm_shuffle_epi8(in[b], _mm_load_si128((const __m128i*)table.shuffle[j][b])));
+		}
+		out[j] = result;
+	}
+}
+
+template <int C>
+struct FlipSse
+{
+	// Swaps mirrored groups from both ends while they do not overlap, and
+	// returns how many pixels were done at each end
+	IP_TARGET_SSE41 static int groups(uint8_t* row, int width)
+	{
+		const FlipTable& table = flip_table<C>();
+		__m128i left[C], right[C], out[C];
+		int x = 0;
+
+		for (; x + 2 * GROUP <= width - x; x += GROUP)
+		{
+			uint8_t* l = row + x * C;
+			uint8_t* r = row + (width - x - GROUP) * C;
+			for (int b = 0; b < C; ++b)
+			{
+				left[b] = _mm_loadu_si128((const __m128i*)(l + b * 16));
+				right[b] = _mm_loadu_si128((const __m128i*)(r + b * 16));
+			}
+
+			reverse_group<C>(right, out, table);
+			reverse_group<C>(left, right, table);
+			for (int b = 0; b < C; ++b)
+			{
+				_mm_storeu_si128((__m128i*)(l + b * 16), out[b]);
+				_mm_storeu_si128((__m128i*)(r + b * 16), right[b]);
+			}
+		}
+
+		return x;
+	}
+
+	static void run(uint8_t* row, int width)
+	{
+		int x = groups(row, width);
+		FlipScalar<C>::run(row, x, width - x);
+	}
+};
+
+template <int C>
+struct CopySse
+{
+	IP_TARGET_SSE41 static int groups(const uint8_t* src, uint8_t* dst, int width)
+	{
+		const FlipTable& table = flip_table<C>();
+		__m128i in[C], out[C];
+		int x = 0;
+
+		for (; x + GROUP <= width; x += GROUP)
+		{
+			const uint8_t* s = src + (width - x - GROUP) * C;
+			for (int b = 0; b < C; ++b)
+			{
+				in[b] = _mm_loadu_si128((const __m128i*)(s + b * 16));
+			}
+
+			reverse_group<C>(in, out, table);
+			for (int b = 0; b < C; ++b)
+			{
+				_mm_storeu_si128((__m128i*)(dst + x * C + b * 16), out[b]);
+			}
+		}
+
+		return x;
+	}
+
+	static void run(const uint8_t* src, uint8_t* dst, int width)
+	{
+		int x = groups(src, dst, width);
+		CopyScalar<C>::run(src, dst, width, x, width);
+	}
+};
+
+#endif
+
+void flip_row(uint8_t* row, int width, int channels)
+{
+#if IP_X86
+	if (simd_level() >= SIMD_SSE41)
+	{
+		with_channels<FlipSse>(channels, row, width);
+		return;
+	}
+#endif
+
+	with_channels<FlipScalar>(channels, row, 0, width);
+}
+
+void flip_row(const uint8_t* src, uint8_t* dst, int width, int channels)
+{
+#if IP_X86
+	if (simd_level() >= SIMD_SSE41)
+	{
+		with_channels<CopySse>(channels, src, dst, width);
+		return;
+	}
+#endif
+
+	with_channels<CopyScalar>(channels, src, dst, width, 0, width);
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+
+// Horizontal mirroring of one row of interleaved pixels with 1 to 4 channels.
+// Pixels are reversed 16 at a time with byte shuffles when the CPU has
+// SSE4.1, so a row is mirrored at close to the speed of copying it; rows
+// shorter than two such groups, and the middle of longer ones, are swapped
+// a pixel at a time.
+
+// Reverses the order of the pixels in row, in place
+void flip_row(uint8_t* row, int width, int channels);
+
+// Writes the pixels of src to dst in reverse order. The rows must not overlap
+void flip_row(const uint8_t* src, uint8_t* dst, int width, int channels);
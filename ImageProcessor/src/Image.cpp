@@ -1,11 +1,24 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
+// Decode straight into memory that a PixelBuffer can own
+#define STBI_MALLOC(sz) pixel_alloc(sz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz) pixel_realloc(p, oldsz, newsz)
+#define STBI_FREE(p) pixel_free(p)
 #include "Image.h"
+#include "MappedFile.h"
+#include "PngEncoder.h"
+#include "Profile.h"
 #include "stb_image.h"
 #include "stb_image_write.h"
+#include "Resample.h"
+#include "Rotate.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <iostream>
-#define BYTE_BOUND(x) x < 0 ? 0 : (x > 255 ? 255 : x)
-#define MAP_BLACK_WHITE(x, cutoff) x <= cutoff ? 0 : 255;
 
 using namespace std;
 
@@ -16,495 +29,560 @@ Image::Image(const char* filename)
 	{
 		printf("Successfully read %s\n", filename);
 		cout << "Image has width = " << width << " and height = " << height << endl;
-		size = width * height * channels;
 		valid = true;
 	}
 	else
 		printf("Failed to read %s :(\n", filename);
 }
 
-Image::Image(int w, int h, int channels) : width(w), height(h), channels(channels)
+Image::Image(const uint8_t* bytes, size_t length, const ReadOptions& options)
 {
-	size = width * height * channels;
-	data = new uint8_t[size];
+	valid = read(bytes, length, options);
 }
 
-Image::Image(const Image& img) : Image(img.width, img.height, img.channels)
+Image::Image(int w, int h, int channels) : channels(channels)
 {
-	memcpy(data, img.data, img.size);
+	set_pixels(PixelBuffer((size_t)w * h * channels), w, h);
 }
 
-Image::~Image()
+Image::Image(const Image& img) : Image(img.width, img.height, img.channels)
 {
-	stbi_image_free(data);
+	memcpy(data, img.data, img.size);
+	valid = img.valid;
 }
 
-bool Image::read(const char* filename)
+Image::Image(Image&& img) noexcept
+	: pixels(std::move(img.pixels)), data(img.data), size(img.size),
+	width(img.width), height(img.height), channels(img.channels), valid(img.valid)
 {
-	data = stbi_load(filename, &width, &height, &channels, 0);
-	return data != nullptr;
+	img.data = nullptr;
+	img.size = 0;
+	img.width = img.height = 0;
+	img.valid = false;
 }
 
-bool Image::write(const char* filename)
+Image& Image::operator=(const Image& img)
 {
-	ImageType type = getFileType(filename);
-	int success = 0;
-
-	switch (type)
+	if (this != &img)
 	{
-	case PNG:
-		success = stbi_write_png(filename, width, height, channels, data, width * channels);
-		break;
-	case JPG:
-		success = stbi_write_jpg(filename, width, height, channels, data, 100);
-		break;
-	case BMP:
-		success = stbi_write_bmp(filename, width, height, channels, data);
-		break;
-	case TGA:
-		success = stbi_write_tga(filename, width, height, channels, data);
-		break;
+		channels = img.channels;
+		set_pixels(PixelBuffer(img.size), img.width, img.height);
+		memcpy(data, img.data, img.size);
+		valid = img.valid;
 	}
 
-	return success != 0;
+	return *this;
 }
 
-ImageType Image::getFileType(const char* filename)
+Image& Image::operator=(Image&& img) noexcept
 {
-	const char* ext = strrchr(filename, '.');
-	if (ext)
+	if (this != &img)
 	{
-		if (strcmp(ext, ".png") == 0)
-			return PNG;
-		if (strcmp(ext, ".jpg") == 0)
-			return JPG;
-		if (strcmp(ext, ".bmp") == 0)
-			return BMP;
-		if (strcmp(ext, ".tga") == 0)
-			return TGA;
+		pixels = std::move(img.pixels);
+		data = img.data;
+		size = img.size;
+		width = img.width;
+		height = img.height;
+		channels = img.channels;
+		valid = img.valid;
+
+		img.data = nullptr;
+		img.size = 0;
+		img.width = img.height = 0;
+		img.valid = false;
 	}
 
-	return PNG;
+	return *this;
 }
 
-Image& Image::flipX()
+void Image::set_pixels(PixelBuffer&& buffer, int w, int h)
 {
-	uint8_t temp[4];
-	uint8_t* px1;
-	uint8_t* px2;
-	for (int y = 0; y < height; ++y)
-	{
-		for (int x = 0; x < width/2; ++x)
-		{
-			px1 = &data[(x + y * width) * channels];
-			px2 = &data[((width - 1 - x) + y * width) * channels];
-			memcpy(temp, px1, channels);
-			memcpy(px1, px2, channels);
-			memcpy(px2, temp, channels);
-		}
-	}
-
-	return *this;
+	pixels = std::move(buffer);
+	data = pixels.data();
+	size = (size_t)w * h * channels;
+	width = w;
+	height = h;
 }
 
-Image& Image::flipY()
+void Image::set_thread_count(int count)
 {
-	uint8_t temp[4];
-	uint8_t* px1;
-	uint8_t* px2;
-	for (int x = 0; x < width; ++x)
-	{
-		for (int y = 0; y < height / 2; ++y)
-		{
-			px1 = &data[(x + y * width) * channels];
-			px2 = &data[(x + (height - 1 - y) * width) * channels];
-			memcpy(temp, px1, channels);
-			memcpy(px1, px2, channels);
-			memcpy(px2, temp, channels);
-		}
-	}
+	ThreadPool::set_worker_count(count);
+}
 
-	return *this;
+// Scale to decode at, 1 if options asks for an unsupported one
+static int read_scale(const ReadOptions& options)
+{
+	int scale = options.downscale;
+	return scale == 2 || scale == 4 || scale == 8 ? scale : 1;
 }
 
-Image& Image::crop(uint16_t start_x, uint16_t start_y, uint16_t new_height, uint16_t new_width)
+// Takes ownership of pixels decoded by stb and, when reading at reduced scale,
+// shrinks images that the decoder returned at their full_w x full_h size.
+// Only JPEGs are decoded at reduced size.
+static bool adopt_decoded(Image& img, uint8_t* loaded, int w, int h, int full_w, int full_h, int scale)
 {
-	size = new_width * new_height * channels;
-	uint8_t* croppedImage = new uint8_t[size];
-	memset(croppedImage, 0, size);
+	if (!loaded) return false;
 
-	for (uint16_t y = 0; y < new_height; ++y)
+	img.set_pixels(PixelBuffer::adopt(loaded, (size_t)w * h * img.channels), w, h);
+	if (scale == 1) return true;
+
+	int target_w = (full_w + scale - 1) / scale;
+	int target_h = (full_h + scale - 1) / scale;
+	if (w != target_w || h != target_h)
 	{
-		if (y + start_y >= height) break;
+		PixelBuffer reduced((size_t)target_w * target_h * img.channels);
+		ImageView dst(reduced.data(), target_w, target_h, img.channels, (ptrdiff_t)target_w * img.channels);
+		block_downscale(img.view(), dst, scale);
+		img.set_pixels(std::move(reduced), target_w, target_h);
+	}
 
-		for (uint16_t x = 0; x < new_width; ++x)
-		{
-			if (x + start_x >= width) break;
+	return true;
+}
 
-			memcpy(&croppedImage[(x + y * new_width) * channels], &data[(x + start_x + (start_y + y) * width) * channels], channels);
-		}
-	}
+// Decodes an image held in memory. Shared by both reads, so reading a file
+// is timed as one read rather than also as a decode
+static bool decode_from(Image& img, const uint8_t* bytes, size_t length, const ReadOptions& options)
+{
+	// stb takes the length as an int
+	if (length > INT_MAX) return false;
 
-	width = new_width;
-	height = new_height;
+	int scale = read_scale(options);
+	int full_w = 0, full_h = 0, file_channels;
+	if (scale != 1 && !stbi_info_from_memory(bytes, (int)length, &full_w, &full_h, &file_channels))
+		return false;
 
-	delete[] data;
-	data = croppedImage;
-	croppedImage = nullptr;
+	int w, h;
+	stbi_set_jpeg_scale_thread(scale);
+	uint8_t* loaded = stbi_load_from_memory(bytes, (int)length, &w, &h, &img.channels, 0);
+	stbi_set_jpeg_scale_thread(1);
 
-	return *this;
+	return adopt_decoded(img, loaded, w, h, full_w, full_h, scale);
 }
 
-Image& Image::resize(int new_width, int new_height)
+bool Image::read(const char* filename, const ReadOptions& options)
 {
-	
-
-	double x_ratio = width / (double)new_width;
-	double y_ratio = height / (double)new_height;
+	IP_PROFILE_SCOPE("read", 0);
 
-	int new_size = new_width * new_height * channels;
-	uint8_t* dst = new uint8_t[new_size];
-	memset(dst, 0, new_size);
-
-	for (int y = 0; y < new_height; ++y)
+	// Decode straight from the page cache when the file can be mapped
+	MappedFile file;
+	if (file.open(filename) && file.size() <= INT_MAX)
 	{
-		for (int x = 0; x < new_width; ++x)
-		{
-			int px = x * x_ratio;
-			int py = y * y_ratio;
+		bool success = decode_from(*this, file.data(), file.size(), options);
+		IP_PROFILE_PIXELS((uint64_t)width * height);
+		return success;
+	}
 
-			int dstIndex = (y * new_width + x) * channels;
-			int srcIndex = (py * width + px) * channels;
+	// Otherwise, as for pipes and very large files, let stb read it through stdio
+	int scale = read_scale(options);
 
-			for (int channel = 0; channel < channels; ++channel)
-			{
-				dst[dstIndex + channel] = data[srcIndex + channel];
-			}
-		}
-	}
+	// The stored size, to tell whether the decoder already reduced the image
+	int full_w = 0, full_h = 0, file_channels;
+	if (scale != 1 && !stbi_info(filename, &full_w, &full_h, &file_channels))
+		return false;
 
-	delete[] data;
-	data = dst;
-	dst = nullptr;
+	int w, h;
+	stbi_set_jpeg_scale_thread(scale);
+	uint8_t* loaded = stbi_load(filename, &w, &h, &channels, 0);
+	stbi_set_jpeg_scale_thread(1);
 
-	width = new_width;
-	height = new_height;
-	size = new_size;
+	bool success = adopt_decoded(*this, loaded, w, h, full_w, full_h, scale);
+	IP_PROFILE_PIXELS((uint64_t)width * height);
+	return success;
+}
 
-	return *this;
+bool Image::read(const uint8_t* bytes, size_t length, const ReadOptions& options)
+{
+	IP_PROFILE_SCOPE("decode", 0);
+	bool success = decode_from(*this, bytes, length, options);
+	IP_PROFILE_PIXELS((uint64_t)width * height);
+	return success;
 }
 
-Image& Image::scale(double ratio)
+// Names the format stb_image recognized from the file's signature. TGA has
+// none, and is the last format stb tries, so it is whatever is left
+static const char* format_of(const uint8_t* head, size_t length)
 {
-	int new_width = ratio * width;
-	int new_height = ratio * height;
+	auto starts_with = [&](const char* magic, size_t n) { return length >= n && memcmp(head, magic, n) == 0; };
+
+	if (starts_with("\xFF\xD8", 2)) return "jpg";
+	if (starts_with("\x89PNG\r\n\x1A\n", 8)) return "png";
+	if (starts_with("GIF8", 4)) return "gif";
+	if (starts_with("BM", 2)) return "bmp";
+	if (starts_with("8BPS", 4)) return "psd";
+	if (starts_with("\x53\x80\xF6\x34", 4)) return "pic";
+	if (starts_with("P5", 2) || starts_with("P6", 2)) return "pnm";
+	if (starts_with("#?RADIANCE\n", 11) || starts_with("#?RGBE\n", 7)) return "hdr";
+	return "tga";
+}
 
-	return resize(new_width, new_height);
+ImageInfo Image::probe(const char* filename)
+{
+	MappedFile file;
+	if (file.open(filename))
+		return probe(file.data(), file.size());
+
+	// Pipes cannot be mapped or read twice, so take everything they hold
+	std::ifstream in(filename, std::ios::binary);
+	std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	return probe(bytes.data(), bytes.size());
 }
 
-Image& Image::grayscale_avg()
+ImageInfo Image::probe(const uint8_t* bytes, size_t length)
 {
-	if (channels < 3)
+	IP_PROFILE_SCOPE("probe", 0);
+
+	// Headers sit at the start, so very large inputs only need their first 2 GiB looked at
+	ImageInfo info;
+	if (bytes && stbi_info_from_memory(bytes, (int)std::min<size_t>(length, INT_MAX), &info.width, &info.height, &info.channels))
 	{
-		printf("Image has less than 3 channels. Probably already grayscaled.");
+		info.valid = true;
+		info.format = format_of(bytes, length);
 	}
-	else
+
+	return info;
+}
+
+// Runs the encoder for `type`, which passes the output to func in pieces
+static bool encode_to(const Image& img, ImageType type, const WriteOptions& options, stbi_write_func* func, void* context)
+{
+	int success = 0;
+
+	switch (type)
 	{
-		for (int i = 0; i < size; i += channels)
+	case PNG:
+		// Chunks are far below 2 GiB, so their sizes fit stb's int
+		success = encode_png(img.data, img.width, img.height, img.channels, options.png_level, options.png_filter, [&](const uint8_t* bytes, size_t length)
 		{
-			int gray = (data[i] + data[i + 1] + data[i + 2]) / 3;
-			memset(data + i, gray, 3);
-		}
+			func(context, (void*)bytes, (int)length);
+		});
+		break;
+	case JPG:
+	{
+		int subsample = options.jpeg_subsampling == CHROMA_420 ? 1 : options.jpeg_subsampling == CHROMA_444 ? 0 : -1;
+		success = stbi_write_jpg_to_func_subsampled(func, context, img.width, img.height, img.channels, img.data, options.jpeg_quality, subsample);
+		break;
+	}
+	case BMP:
+		success = stbi_write_bmp_to_func(func, context, img.width, img.height, img.channels, img.data);
+		break;
+	case TGA:
+		success = stbi_write_tga_to_func_rle(func, context, img.width, img.height, img.channels, img.data, options.tga_rle);
+		break;
 	}
 
-	return *this;
+	return success != 0;
 }
 
-Image& Image::grayscale_lum()
+bool Image::write(const char* filename, const WriteOptions& options)
 {
-	if (channels < 3)
+	IP_PROFILE_SCOPE("write", (uint64_t)width * height);
+	ImageType type = getFileType(filename);
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+
+	auto append = [](void* context, void* bytes, int size)
 	{
-		printf("Image has less than 3 channels. Probably already grayscaled.");
-	}
-	else
+		((std::ofstream*)context)->write((const char*)bytes, size);
+	};
+
+	bool success = encode_to(*this, type, options, append, &file);
+	file.close();
+	return success && !file.fail();
+}
+
+std::vector<uint8_t> Image::encode(ImageType type, const WriteOptions& options) const
+{
+	IP_PROFILE_SCOPE("encode", (uint64_t)width * height);
+	std::vector<uint8_t> encoded;
+	auto append = [](void* context, void* bytes, int size)
 	{
-		for (int i = 0; i < size; i += channels)
-		{
-			int gray = 0.2126 * data[i] + 0.7152 * data[i + 1] + 0.0722 * data[i + 2];
-			memset(data + i, gray, 3);
-		}
-	}
+		std::vector<uint8_t>& out = *(std::vector<uint8_t>*)context;
+		out.insert(out.end(), (uint8_t*)bytes, (uint8_t*)bytes + size);
+	};
 
-	return *this;
+	if (!encode_to(*this, type, options, append, &encoded))
+		encoded.clear();
+
+	return encoded;
 }
 
-Image& Image::color_mask(float r, float g, float b)
+size_t Image::encode(ImageType type, uint8_t* buffer, size_t capacity, const WriteOptions& options) const
 {
-	if (channels < 3)
+	IP_PROFILE_SCOPE("encode", (uint64_t)width * height);
+	struct Output
 	{
-		printf("Image has less than 3 channels, a color mask cannot be applied.");
-	}
-	else
+		uint8_t* buffer;
+		size_t capacity;
+		size_t size;
+	};
+
+	// Keeps counting past the end of the buffer so callers learn the full size
+	Output output = { buffer, capacity, 0 };
+	auto copy = [](void* context, void* bytes, int size)
 	{
-		for (int i = 0; i < size; i += channels)
-		{
-			data[i] *= r;
-			data[i+1] *= g;
-			data[i+2] *= b;
-		}
-	}
+		Output& out = *(Output*)context;
+		if (out.size < out.capacity)
+			memcpy(out.buffer + out.size, bytes, std::min((size_t)size, out.capacity - out.size));
+		out.size += size;
+	};
 
-	return *this;
+	return encode_to(*this, type, options, copy, &output) ? output.size : 0;
 }
 
-Image& Image::pixelize(int strength)
+// Measured on a 4928x3264 photograph, against the defaults (PNG 7.2 MB in
+// 2.3 s, JPEG 3.5 MB): fastest writes PNGs 3.5x faster and 11% larger,
+// balanced 1.5x faster and 5% larger, and smallest 4% smaller at 1.7x the
+// time. Up filters nearly every row of a photograph as well as adaptive
+// filtering does, without trying all five filters per row. JPEGs shrink to
+// under a quarter at quality 90 with 4:2:0 chroma, and to a sixth at quality 80
+WriteOptions WriteOptions::fastest()
+{
+	WriteOptions options;
+	options.jpeg_quality = 90;
+	options.jpeg_subsampling = CHROMA_420;
+	options.png_level = 1;
+	options.png_filter = PNG_FILTER_UP;
+	options.tga_rle = false;
+	return options;
+}
+
+WriteOptions WriteOptions::balanced()
+{
+	WriteOptions options;
+	options.jpeg_quality = 90;
+	options.jpeg_subsampling = CHROMA_420;
+	options.png_level = 3;
+	return options;
+}
+
+WriteOptions WriteOptions::smallest()
 {
-	int new_width = width - (width % strength);
-	int new_height = height - (height % strength);
-	int new_size = new_width * new_height * channels;
+	WriteOptions options;
+	options.jpeg_quality = 80;
+	options.jpeg_subsampling = CHROMA_420;
+	options.png_level = 24;
+	return options;
+}
+
+ImageView Image::view()
+{
+	return ImageView(data, width, height, channels, (ptrdiff_t)width * channels);
+}
 
-	uint8_t* dst = new uint8_t[new_size];
-	memset(dst, 0, new_size);
+ImageView Image::crop_view(int start_x, int start_y, int new_width, int new_height)
+{
+	return view().crop(start_x, start_y, new_width, new_height);
+}
 
-	for (uint16_t y = 0; y < new_height; y += strength)
+ImageType Image::getFileType(const char* filename)
+{
+	const char* ext = strrchr(filename, '.');
+	if (ext)
 	{
-		for (uint16_t x = 0; x < new_width; x += strength)
+		// Extensions are matched case-insensitively, so "photo.JPG" stays a JPEG
+		char lower[8] = {};
+		for (size_t i = 0; i < sizeof(lower) - 1 && ext[i]; ++i)
 		{
-			for (int channel = 0; channel < channels; ++channel)
-			{
-				double sum = 0;
-
-				for (int i = y; i < y + strength; ++i)
-				{
-					for (int j = x; j < x + strength; ++j)
-					{
-						sum += data[(i * width + j) * channels + channel];
-					}
-				}
-				
-				uint8_t new_value = round(sum / (strength * strength));
-
-				for (int i = y; i < y + strength; ++i)
-				{
-					for (int j = x; j < x + strength; ++j)
-					{
-						int index = (i * new_width + j) * channels + channel;
-						dst[index] = BYTE_BOUND(new_value);
-					}
-				}
-			}
+			lower[i] = (char)tolower((unsigned char)ext[i]);
 		}
+
+		if (strcmp(lower, ".png") == 0)
+			return PNG;
+		if (strcmp(lower, ".jpg") == 0 || strcmp(lower, ".jpeg") == 0)
+			return JPG;
+		if (strcmp(lower, ".bmp") == 0)
+			return BMP;
+		if (strcmp(lower, ".tga") == 0)
+			return TGA;
 	}
 
-	delete[] data;
-	data = dst;
-	dst = nullptr;
+	return PNG;
+}
 
-	width = new_width;
-	height = new_height;
-	size = new_size;
+Image& Image::flipX()
+{
+	IP_PROFILE_SCOPE("flipX", (uint64_t)width * height);
+	view().flipX();
+	return *this;
+}
 
+Image& Image::flipY()
+{
+	IP_PROFILE_SCOPE("flipY", (uint64_t)width * height);
+	view().flipY();
 	return *this;
 }
 
-int get_border_values(int M, int x)
+// Makes dst an image of the same size and channels as src
+static ImageView match_shape(const Image& src, Image& dst)
 {
-	if (x < 0)
-	{
-		return -x - 1;
-	}
-	if (x >= M)
-	{
-		return 2 * M - x - 1;
-	}
-	
-	return x;
+	if (dst.width != src.width || dst.height != src.height || dst.channels != src.channels)
+		dst = Image(src.width, src.height, src.channels);
+
+	dst.valid = src.valid;
+	return dst.view();
 }
 
-Image& Image::gaussian_blur(int strength)
+Image& Image::flipX_to(Image& dst) const
 {
-	// Coefficients of a 1-dimensional gaussian kernel with sigma = 1
-	std::vector<double> kernel;
-	int kernel_length = 3;
-	
-	switch (strength)
-	{
-	case 1:
-		kernel = { 0.27901,	0.44198, 0.27901 };
-		break;
-	case 2:
-		kernel = { 0.06136,	0.24477, 0.38774, 0.24477, 0.06136 };
-		kernel_length = 5;
-		break;
-	case 3:
-		kernel = { 0.00598,	0.060626, 0.241843, 0.383103, 0.241843, 0.060626, 0.00598 };
-		kernel_length = 7;
-		break;
-	case 4:
-		kernel = { 0.000229, 0.005977, 0.060598, 0.241732, 0.382928, 0.241732, 0.060598, 0.005977, 0.000229 };
-		kernel_length = 9;
-		break;
-	default:
-		kernel = { 0.27901,	0.44198, 0.27901 };
-	}
+	IP_PROFILE_SCOPE("flipX_to", (uint64_t)width * height);
+	ImageView target = match_shape(*this, dst);
+	ImageView(data, width, height, channels, (ptrdiff_t)width * channels).flipX_to(target);
+	return dst;
+}
 
-	uint8_t* temp = new uint8_t[size];
-	memset(temp, 0, size);
+Image& Image::flipY_to(Image& dst) const
+{
+	IP_PROFILE_SCOPE("flipY_to", (uint64_t)width * height);
+	ImageView target = match_shape(*this, dst);
+	ImageView(data, width, height, channels, (ptrdiff_t)width * channels).flipY_to(target);
+	return dst;
+}
 
-	int N = (kernel_length - 1) / 2;
+// Replaces the pixels with the result of turn(src, dst) for a dst with width and height swapped
+static Image& turn_quarter(Image& img, void (*turn)(const ImageView&, const ImageView&))
+{
+	PixelBuffer turned(img.size);
+	ImageView dst(turned.data(), img.height, img.width, img.channels, (ptrdiff_t)img.height * img.channels);
 
-	// Apply blur along Y axis
-	for (int y = 0; y < height; ++y)
-	{
-		for (int x = 0; x < width; ++x)
-		{
-			for (int channel = 0; channel < channels; ++channel)
-			{
-				double sum = 0;
-
-				for (int i = -N; i <= N; i++) {
-					int index = (get_border_values(height, y + i) * width + x) * channels + channel;
-					sum += kernel[i + N] * data[index];
-				}
-				
-				uint8_t new_value = round(sum);
-				temp[(y * width + x) * channels + channel] = BYTE_BOUND(new_value);
-			}
-		}
-	}
+	turn(img.view(), dst);
 
+	img.set_pixels(std::move(turned), img.height, img.width);
+	return img;
+}
 
-	// Apply blur along X axis
-	for (int y = 0; y < height; ++y)
-	{
-		for (int x = 0; x < width; ++x)
-		{
-			for (int channel = 0; channel < channels; ++channel)
-			{
-				double sum = 0;
-
-				for (int i = -N; i <= N; i++) {
-					int index = (y * width + get_border_values(width, x + i)) * channels + channel;
-					sum += kernel[i + N] * temp[index];
-				}
-
-				uint8_t new_value = round(sum);
-				data[(y * width + x) * channels + channel] = BYTE_BOUND(new_value);
-			}
-		}
-	}
+Image& Image::rotate90()
+{
+	IP_PROFILE_SCOPE("rotate90", (uint64_t)width * height);
+	return turn_quarter(*this, ::rotate90);
+}
 
-	delete[] temp;
+Image& Image::rotate180()
+{
+	IP_PROFILE_SCOPE("rotate180", (uint64_t)width * height);
+	view().rotate180();
 	return *this;
 }
 
-Image& Image::edge_detection(double cutoff)
+Image& Image::rotate270()
 {
-	grayscale_avg();
-
-	int sobel_kernel_x[] = {1, 0, -1, 2, 0, -2, 1, 0, -1};
-	int sobel_kernel_y[] = { -1, -2, -1, 0, 0, 0, 1, 2, 1 };
+	IP_PROFILE_SCOPE("rotate270", (uint64_t)width * height);
+	return turn_quarter(*this, ::rotate270);
+}
 
-	int8_t* tempX = new int8_t[size];
-	int8_t* tempY = new int8_t[size];
+Image& Image::transpose()
+{
+	IP_PROFILE_SCOPE("transpose", (uint64_t)width * height);
+	return turn_quarter(*this, ::transpose);
+}
 
-	memset(tempX, 0, size);
-	memset(tempY, 0, size);
+Image& Image::crop(uint16_t start_x, uint16_t start_y, uint16_t new_height, uint16_t new_width)
+{
+	IP_PROFILE_SCOPE("crop", (uint64_t)width * height);
+	PixelBuffer cropped((size_t)new_width * new_height * channels);
+	uint8_t* croppedImage = cropped.data();
 
-	// Apply edge detection kernel along X axis
-	for (int y = 0; y < height; ++y)
+	// Only the part of the region that lies outside the image is zeroed
+	size_t row_bytes = (size_t)new_width * channels;
+	size_t copied = (size_t)std::max(0, std::min((int)new_width, width - start_x)) * channels;
+	for (uint16_t y = 0; y < new_height; ++y)
 	{
-		for (int x = 0; x < width; ++x)
+		uint8_t* out = croppedImage + y * row_bytes;
+		if (y + start_y >= height)
 		{
-			for (int channel = 0; channel < channels; ++channel)
-			{
-				int8_t sum = 0;
-
-				for (int i = -1; i <= 1; i++) {
-					for (int j = -1; j <= 1; ++j)
-					{
-						int kernel_index = 4 + i * 3 + j;
-						int index = (get_border_values(height, y + i) * width + get_border_values(width, x + j)) * channels + channel;
-						sum += sobel_kernel_x[kernel_index] * data[index];
-					}
-				}
-
-				tempX[(y * width + x) * channels + channel] = sum;
-			}
+			memset(out, 0, (new_height - y) * row_bytes);
+			break;
 		}
+
+		if (copied)
+			memcpy(out, &data[((size_t)start_x + (size_t)(start_y + y) * width) * channels], copied);
+		memset(out + copied, 0, row_bytes - copied);
 	}
 
+	set_pixels(std::move(cropped), new_width, new_height);
+	return *this;
+}
 
-	// Apply edge detection kernel along Y axis
-	for (int y = 0; y < height; ++y)
-	{
-		for (int x = 0; x < width; ++x)
-		{
-			for (int channel = 0; channel < channels; ++channel)
-			{
-				int8_t sum = 0;
-
-				for (int i = -1; i <= 1; i++) {
-					for (int j = -1; j <= 1; ++j)
-					{
-						int kernel_index = 4 + i * 3 + j;
-						int index = (get_border_values(height, y + i) * width + get_border_values(width, x + j)) * channels + channel;
-						sum += sobel_kernel_y[kernel_index] * data[index];
-					}
-				}
-
-				tempY[(y * width + x) * channels + channel] = sum;
-			}
-		}
-	}
+// Shared by resize and scale, so each call is timed under one name
+static void resize_to(Image& img, int new_width, int new_height, ResizeFilter filter)
+{
+	PixelBuffer resized((size_t)new_width * new_height * img.channels);
+	ImageView dst(resized.data(), new_width, new_height, img.channels, (ptrdiff_t)new_width * img.channels);
 
-	for (size_t i = 0; i < size; ++i)
-	{
-		data[i] = MAP_BLACK_WHITE(round(sqrt(tempX[i] * tempX[i] + tempY[i] * tempY[i])), cutoff);
-	}
+	resample(img.view(), dst, filter);
 
-	delete[] tempX;
-	delete[] tempY;
+	img.set_pixels(std::move(resized), new_width, new_height);
+}
+
+Image& Image::resize(int new_width, int new_height, ResizeFilter filter)
+{
+	IP_PROFILE_SCOPE("resize", (uint64_t)width * height);
+	resize_to(*this, new_width, new_height, filter);
 	return *this;
 }
 
-Image& Image::sharpen()
+Image& Image::scale(double ratio, ResizeFilter filter)
 {
-	double kernel[] = { -0.11111, -0.11111, -0.11111, -0.11111, 2, -0.11111, -0.11111, -0.11111, -0.11111 };
+	IP_PROFILE_SCOPE("scale", (uint64_t)width * height);
+	int new_width = ratio * width;
+	int new_height = ratio * height;
 
-	uint8_t* dst = new uint8_t[size];
-	memset(dst, 0, size);
+	resize_to(*this, new_width, new_height, filter);
+	return *this;
+}
 
-	// Apply sharpening kernel
-	for (int y = 0; y < height; ++y)
-	{
-		for (int x = 0; x < width; ++x)
-		{
-			for (int channel = 0; channel < channels; ++channel)
-			{
-				double sum = 0;
-
-				for (int i = -1; i <= 1; i++) {
-					for (int j = -1; j <= 1; ++j)
-					{
-						int kernel_index = 4 + i * 3 + j;
-						int index = (get_border_values(height, y + i) * width + get_border_values(width, x + j)) * channels + channel;
-						sum += kernel[kernel_index] * data[index];						
-					}
-				}
-
-				dst[(y * width + x) * channels + channel] = BYTE_BOUND(round(sum));
-			}
-		}
-	}
+Image& Image::grayscale_avg()
+{
+	IP_PROFILE_SCOPE("grayscale_avg", (uint64_t)width * height);
+	view().grayscale_avg();
+	return *this;
+}
 
-	for (size_t i = 0; i < size; ++i)
-	{
-		data[i] = (dst[i] + data[i]) / 2;
-	}
+Image& Image::grayscale_lum()
+{
+	IP_PROFILE_SCOPE("grayscale_lum", (uint64_t)width * height);
+	view().grayscale_lum();
+	return *this;
+}
 
-	delete[] dst;
-	dst = nullptr;
+Image& Image::color_mask(float r, float g, float b)
+{
+	IP_PROFILE_SCOPE("color_mask", (uint64_t)width * height);
+	view().color_mask(r, g, b);
+	return *this;
+}
 
+Image& Image::pixelize(int strength)
+{
+	IP_PROFILE_SCOPE("pixelize", (uint64_t)width * height);
+	view().pixelize(strength);
+	return *this;
+}
+
+Image& Image::gaussian_blur(int strength)
+{
+	IP_PROFILE_SCOPE("gaussian_blur", (uint64_t)width * height);
+	view().gaussian_blur(strength);
+	return *this;
+}
+
+Image& Image::gaussian_blur_sigma(double sigma)
+{
+	IP_PROFILE_SCOPE("gaussian_blur_sigma", (uint64_t)width * height);
+	view().gaussian_blur_sigma(sigma);
+	return *this;
+}
+
+Image& Image::edge_detection(double cutoff)
+{
+	IP_PROFILE_SCOPE("edge_detection", (uint64_t)width * height);
+	view().edge_detection(cutoff);
+	return *this;
+}
+
+Image& Image::sharpen()
+{
+	IP_PROFILE_SCOPE("sharpen", (uint64_t)width * height);
+	view().sharpen();
 	return *this;
 }
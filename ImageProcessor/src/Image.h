@@ -1,9 +1,11 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <inttypes.h>
 #include <cmath>
 #include <complex>
 #include <vector>
+#include "PixelBuffer.h"
 #define _USE_MATH_DEFINES
 
 enum ImageType
@@ -11,42 +13,196 @@ enum ImageType
 	PNG, JPG, BMP, TGA
 };
 
+// Sampling filters for resize and scale, from fastest to sharpest
+enum ResizeFilter
+{
+	NEAREST, BILINEAR, BICUBIC, LANCZOS3
+};
 
-struct Image
+
+// Non-owning window into pixels owned elsewhere. Rows are `stride` bytes apart,
+// so a view can describe a region of a larger image without copying it. The
+// filters below only read and write pixels inside the view, and neighbourhood
+// filters mirror at the view's own borders.
+struct ImageView
 {
 	uint8_t* data = nullptr;
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	ptrdiff_t stride = 0;
+
+	ImageView() = default;
+	ImageView(uint8_t* data, int width, int height, int channels, ptrdiff_t stride);
+
+	inline uint8_t* row(int y) const { return data + y * stride; }
+
+	// Region of this view, clamped to its bounds
+	ImageView crop(int x, int y, int w, int h) const;
+
+	ImageView& flipX();
+	ImageView& flipY();
+
+	// Write the mirrored view into dst, which must have the same size and
+	// channels and not overlap this view. Cheaper than copying and flipping
+	void flipX_to(const ImageView& dst) const;
+	void flipY_to(const ImageView& dst) const;
+
+	// Half turn, the same as flipX and flipY but in one pass
+	ImageView& rotate180();
+
+	ImageView& grayscale_avg();
+	ImageView& grayscale_lum();
+
+	ImageView& color_mask(float r, float g, float b);
+
+	ImageView& pixelize(int strength = 2);
+
+	ImageView& gaussian_blur(int strength = 2);
+	ImageView& gaussian_blur_sigma(double sigma);
+	ImageView& edge_detection(double cutoff = 115);
+	ImageView& sharpen();
+};
+
+
+// Options for Image::read
+struct ReadOptions
+{
+	// Read at 1/downscale of the stored size: 1, 2, 4 or 8. Each pixel is the
+	// mean of the block it covers, and sizes round up: blocks at the right and
+	// bottom edges average just the pixels they cover. JPEGs are decoded
+	// straight at the smaller size, which is much faster and needs a fraction
+	// of the memory; other formats are decoded in full and then reduced.
+	int downscale = 1;
+};
+
+// Chroma resolution of JPEGs
+enum ChromaSubsampling
+{
+	CHROMA_AUTO, // 4:2:0 at quality 90 and below, 4:4:4 above
+	CHROMA_444,  // Full resolution color
+	CHROMA_420   // Color at half the width and height, for smaller files
+};
+
+// How PNG rows are filtered before compression. ADAPTIVE tries each filter on
+// every row and keeps the one likely to compress best; the others use one
+// filter for the whole image
+enum PngFilter
+{
+	PNG_FILTER_ADAPTIVE = -1, PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVERAGE, PNG_FILTER_PAETH
+};
+
+// Options for Image::write and Image::encode. The defaults match what write
+// has always produced; the presets trade encoding time against file size
+struct WriteOptions
+{
+	int jpeg_quality = 100;                       // 1 to 100
+	ChromaSubsampling jpeg_subsampling = CHROMA_AUTO;
+	int png_level = 8;                            // Compression effort, 1 and up
+	PngFilter png_filter = PNG_FILTER_ADAPTIVE;
+	bool tga_rle = true;                          // Run-length encode TGAs
+
+	static WriteOptions fastest();
+	static WriteOptions balanced();
+	static WriteOptions smallest();
+};
+
+// What Image::probe learns from the header of an encoded image
+struct ImageInfo
+{
+	bool valid = false;
+	int width = 0;
+	int height = 0;
+	int channels = 0;             // Channels a full read returns
+	const char* format = nullptr; // "png", "jpg", "bmp", "tga", "gif", "psd", "pic", "pnm" or "hdr"
+
+	// Bytes a full read decodes into
+	inline size_t size() const { return (size_t)width * height * channels; }
+};
+
+
+struct Image
+{
+	PixelBuffer pixels;
+	uint8_t* data = nullptr; // pixels.data()
 	size_t size = 0;
-	int width;
-	int height;
-	int channels;
+	int width = 0;
+	int height = 0;
+	int channels = 0;
 	bool valid = false;
 
 	Image(const char* filename);
+	// Decodes an encoded image held in memory. Unlike the file constructor,
+	// prints nothing; check is_valid()
+	Image(const uint8_t* bytes, size_t length, const ReadOptions& options = ReadOptions());
 	Image(int w, int h, int channels);
 	Image(const Image& img);
-	~Image();
+	Image(Image&& img) noexcept;
+	Image& operator=(const Image& img);
+	Image& operator=(Image&& img) noexcept;
+
+	// Replaces the pixels with `buffer`, holding w x h pixels of `channels`
+	void set_pixels(PixelBuffer&& buffer, int w, int h);
+
+	bool read(const char* filename, const ReadOptions& options = ReadOptions());
+	bool read(const uint8_t* bytes, size_t length, const ReadOptions& options = ReadOptions());
+	bool write(const char* filename, const WriteOptions& options = WriteOptions());
 
-	bool read(const char* filename);
-	bool write(const char* filename);
+	// Encodes the image as `type` in memory. Returns an empty vector on failure
+	std::vector<uint8_t> encode(ImageType type, const WriteOptions& options = WriteOptions()) const;
+	// Encodes into buffer and returns the encoded size, or 0 on failure. If the
+	// result is larger than capacity, only the first capacity bytes are written,
+	// and the returned size tells how large a buffer to retry with
+	size_t encode(ImageType type, uint8_t* buffer, size_t capacity, const WriteOptions& options = WriteOptions()) const;
 	inline bool is_valid() { return valid; }
 
+	// Reads the size, channel count and format of an image from its header
+	// alone, without decoding any pixels or printing anything. Takes
+	// microseconds, so inputs can be checked before committing to a decode
+	static ImageInfo probe(const char* filename);
+	static ImageInfo probe(const uint8_t* bytes, size_t length);
+
+	// Number of threads used by the filters (0 = one per hardware thread)
+	static void set_thread_count(int count);
+
 	ImageType getFileType(const char* filename);
 
+	// Views share this image's pixels and are invalidated by operations that
+	// reallocate them (crop, resize, scale, rotate90, rotate270 and transpose)
+	ImageView view();
+	ImageView crop_view(int start_x, int start_y, int new_width, int new_height);
+
 	Image& flipX();
 	Image& flipY();
 
+	// Write the mirrored image into dst, resizing it to match, and return dst
+	Image& flipX_to(Image& dst) const;
+	Image& flipY_to(Image& dst) const;
+
+	// Turns clockwise by 90, 180 or 270 degrees. transpose mirrors along the
+	// main diagonal, so pixel (x, y) moves to (y, x). All but rotate180 swap
+	// the width and height and reallocate the pixels
+	Image& rotate90();
+	Image& rotate180();
+	Image& rotate270();
+	Image& transpose();
+
 	Image& crop(uint16_t start_x, uint16_t start_y, uint16_t new_height, uint16_t new_width);
-	Image& resize(int new_width, int new_height);
-	Image& scale(double ratio);
+	Image& resize(int new_width, int new_height, ResizeFilter filter = NEAREST);
+	Image& scale(double ratio, ResizeFilter filter = NEAREST);
 
 	Image& grayscale_avg();
 	Image& grayscale_lum();
 
 	Image& color_mask(float r, float g, float b);
 
+	// Replaces each strength x strength block with its mean color. Blocks at
+	// the right and bottom edges are narrower or shorter when the size is not
+	// a multiple of strength, so the image keeps its size
 	Image& pixelize(int strength = 2);
 
 	Image& gaussian_blur(int strength = 2);
+	Image& gaussian_blur_sigma(double sigma);
 	Image& edge_detection(double cutoff = 115);
 	Image& sharpen();
 };
@@ -0,0 +1,519 @@
+#include "Image.h"
+#include "Flip.h"
+#include "PointOps.h"
+#include "Resample.h"
+#include "RowPipeline.h"
+#include "Scratch.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+ImageView::ImageView(uint8_t* data, int width, int height, int channels, ptrdiff_t stride)
+	: data(data), width(width), height(height), channels(channels), stride(stride)
+{
+}
+
+ImageView ImageView::crop(int x, int y, int w, int h) const
+{
+	// Clamp the region to this view so a view never reaches outside its parent
+	int x0 = std::max(0, std::min(x, width));
+	int y0 = std::max(0, std::min(y, height));
+	int x1 = std::max(x0, std::min(x + w, width));
+	int y1 = std::max(y0, std::min(y + h, height));
+
+	return ImageView(data + y0 * stride + x0 * channels, x1 - x0, y1 - y0, channels, stride);
+}
+
+ImageView& ImageView::flipX()
+{
+	parallel_rows(height, (size_t)width * channels, [&](int y_begin, int y_end)
+	{
+		for (int y = y_begin; y < y_end; ++y)
+		{
+			flip_row(row(y), width, channels);
+		}
+	});
+
+	return *this;
+}
+
+ImageView& ImageView::flipY()
+{
+	// Swaps whole rows in pieces that fit a small buffer, so every pass reads
+	// and writes memory in order
+	size_t row_bytes = (size_t)width * channels;
+	parallel_rows(height / 2, 2 * row_bytes, [&](int y_begin, int y_end)
+	{
+		uint8_t line[4096];
+		for (int y = y_begin; y < y_end; ++y)
+		{
+			uint8_t* top = row(y);
+			uint8_t* bottom = row(height - 1 - y);
+			for (size_t offset = 0; offset < row_bytes; offset += sizeof(line))
+			{
+				size_t length = std::min(sizeof(line), row_bytes - offset);
+				memcpy(line, top + offset, length);
+				memcpy(top + offset, bottom + offset, length);
+				memcpy(bottom + offset, line, length);
+			}
+		}
+	});
+
+	return *this;
+}
+
+ImageView& ImageView::rotate180()
+{
+	// Each pair of rows is reversed into the other's place through one spare row
+	size_t row_bytes = (size_t)width * channels;
+	parallel_rows((height + 1) / 2, 2 * row_bytes, [&](int y_begin, int y_end)
+	{
+		ScratchFrame frame;
+		uint8_t* line = frame.alloc<uint8_t>(row_bytes);
+		for (int y = y_begin; y < y_end; ++y)
+		{
+			uint8_t* top = row(y);
+			uint8_t* bottom = row(height - 1 - y);
+			if (top == bottom)
+			{
+				flip_row(top, width, channels);
+				continue;
+			}
+
+			flip_row(top, line, width, channels);
+			flip_row(bottom, top, width, channels);
+			memcpy(bottom, line, row_bytes);
+		}
+	});
+
+	return *this;
+}
+
+void ImageView::flipX_to(const ImageView& dst) const
+{
+	parallel_rows(height, (size_t)width * channels, [&](int y_begin, int y_end)
+	{
+		for (int y = y_begin; y < y_end; ++y)
+		{
+			flip_row(row(y), dst.row(y), width, channels);
+		}
+	});
+}
+
+void ImageView::flipY_to(const ImageView& dst) const
+{
+	size_t row_bytes = (size_t)width * channels;
+	parallel_rows(height, row_bytes, [&](int y_begin, int y_end)
+	{
+		for (int y = y_begin; y < y_end; ++y)
+		{
+			memcpy(dst.row(height - 1 - y), row(y), row_bytes);
+		}
+	});
+}
+
+ImageView& ImageView::grayscale_avg()
+{
+	if (channels < 3)
+	{
+		printf("Image has less than 3 channels. Probably already grayscaled.");
+	}
+	else
+	{
+		parallel_rows(height, (size_t)width * channels, [&](int y_begin, int y_end)
+		{
+			for (int y = y_begin; y < y_end; ++y)
+			{
+				grayscale_avg_row(row(y), width, channels);
+			}
+		});
+	}
+
+	return *this;
+}
+
+ImageView& ImageView::grayscale_lum()
+{
+	if (channels < 3)
+	{
+		printf("Image has less than 3 channels. Probably already grayscaled.");
+	}
+	else
+	{
+		parallel_rows(height, (size_t)width * channels, [&](int y_begin, int y_end)
+		{
+			for (int y = y_begin; y < y_end; ++y)
+			{
+				grayscale_lum_row(row(y), width, channels);
+			}
+		});
+	}
+
+	return *this;
+}
+
+ImageView& ImageView::color_mask(float r, float g, float b)
+{
+	if (channels < 3)
+	{
+		printf("Image has less than 3 channels, a color mask cannot be applied.");
+	}
+	else
+	{
+		ColorMask mask = make_color_mask(r, g, b);
+		parallel_rows(height, (size_t)width * channels, [&](int y_begin, int y_end)
+		{
+			for (int y = y_begin; y < y_end; ++y)
+			{
+				color_mask_row(row(y), width, channels, mask);
+			}
+		});
+	}
+
+	return *this;
+}
+
+// Writes `count` copies of the pixel px to dst, doubling the filled part each step
+static void fill_pixels(uint8_t* dst, const uint8_t* px, int count, int channels)
+{
+	size_t bytes = (size_t)count * channels;
+	size_t filled = std::min(bytes, (size_t)channels);
+	memcpy(dst, px, filled);
+
+	while (filled < bytes)
+	{
+		size_t length = std::min(filled, bytes - filled);
+		memcpy(dst + filled, dst, length);
+		filled += length;
+	}
+}
+
+#if IP_X86
+// broadcast[c - 1][b] repeats a pixel of c bytes across 16-byte block b of a
+// run of pixels. Runs repeat every block, or every three for RGB
+struct BroadcastTables
+{
+	alignas(16) uint8_t broadcast[4][3][16];
+
+	BroadcastTables()
+	{
+		for (int c = 1; c <= 4; ++c)
+		{
+			for (int b = 0; b < 3; ++b)
+			{
+				for (int i = 0; i < 16; ++i)
+				{
+					broadcast[c - 1][b][i] = (uint8_t)((b * 16 + i) % c);
+				}
+			}
+		}
+	}
+};
+
+// The same with broadcast stores of whole blocks
+IP_TARGET_SSE41 static void fill_pixels_sse(uint8_t* dst, const uint8_t* px, int count, int channels)
+{
+	static const BroadcastTables tables;
+
+	uint32_t value = 0;
+	memcpy(&value, px, channels);
+	__m128i pixel = _mm_cvtsi32_si128((int)value);
+	__m128i blocks[3];
+	for (int b = 0; b < 3; ++b)
+	{
+		blocks[b] = _mm_shuffle_epi8(pixel, _mm_load_si128((const __m128i*)tables.broadcast[channels - 1][b]));
+	}
+
+	size_t bytes = (size_t)count * channels;
+	size_t offset = 0;
+	int period = channels == 3 ? 3 : 1;
+	int b = 0;
+	for (; offset + 16 <= bytes; offset += 16)
+	{
+		_mm_storeu_si128((__m128i*)(dst + offset), blocks[b]);
+		b = b + 1 == period ? 0 : b + 1;
+	}
+
+	if (offset < bytes)
+	{
+		alignas(16) uint8_t tail[16];
+		_mm_store_si128((__m128i*)tail, blocks[b]);
+		memcpy(dst + offset, tail, bytes - offset);
+	}
+}
+#endif
+
+ImageView& ImageView::pixelize(int strength)
+{
+	if (strength < 2 || width <= 0 || height <= 0) return *this;
+
+	// Each band of `strength` rows is summed column by column in one pass,
+	// then every block's mean is the sum of its columns' totals. The band's
+	// first row is then filled block by block and copied to the others
+	size_t row_bytes = (size_t)width * channels;
+	int bands = (height + strength - 1) / strength;
+	void (*fill)(uint8_t*, const uint8_t*, int, int) = fill_pixels;
+#if IP_X86
+	if (simd_level() >= SIMD_SSE41)
+		fill = fill_pixels_sse;
+#endif
+
+	parallel_rows(bands, row_bytes * strength, [&](int band_begin, int band_end)
+	{
+		ScratchFrame frame;
+		uint32_t* columns = frame.alloc<uint32_t>(row_bytes);
+
+		for (int band = band_begin; band < band_end; ++band)
+		{
+			int y0 = band * strength;
+			int y1 = std::min(height, y0 + strength);
+
+			memset(columns, 0, row_bytes * sizeof(uint32_t));
+			for (int y = y0; y < y1; ++y)
+			{
+				const uint8_t* line = row(y);
+				for (size_t i = 0; i < row_bytes; ++i)
+				{
+					columns[i] += line[i];
+				}
+			}
+
+			// All blocks but the last in a band share their area, so the divider is reused
+			uint8_t* first = row(y0);
+			uint64_t divider_area = 0;
+			BoxDivider divider(1);
+
+			for (int x0 = 0; x0 < width; x0 += strength)
+			{
+				int x1 = std::min(width, x0 + strength);
+				uint64_t area = (uint64_t)(x1 - x0) * (y1 - y0);
+				if (area != divider_area && area < 65536)
+				{
+					divider = BoxDivider((int)area);
+					divider_area = area;
+				}
+
+				uint64_t sums[4] = { 0, 0, 0, 0 };
+				const uint32_t* block = &columns[(size_t)x0 * channels];
+				for (int i = 0; i < (x1 - x0) * channels; i += channels)
+				{
+					for (int c = 0; c < channels; ++c)
+					{
+						sums[c] += block[i + c];
+					}
+				}
+
+				// Both round halves up, as round() does for these positive means
+				uint8_t mean[4];
+				for (int c = 0; c < channels; ++c)
+				{
+					mean[c] = area < 65536 ? divider((uint32_t)sums[c]) : (uint8_t)((sums[c] * 2 + area) / (area * 2));
+				}
+
+				fill(first + x0 * channels, mean, x1 - x0, channels);
+			}
+
+			for (int y = y0 + 1; y < y1; ++y)
+			{
+				memcpy(row(y), first, row_bytes);
+			}
+		}
+	});
+
+	return *this;
+}
+
+// Applies a symmetric 1-dimensional kernel along both axes of the image
+static void convolve_separable(const ImageView& view, const std::vector<double>& kernel)
+{
+	BlurStage blur(kernel);
+	run_row_stages(view, view, { &blur });
+}
+
+ImageView& ImageView::gaussian_blur(int strength)
+{
+	convolve_separable(*this, gaussian_strength_kernel(strength));
+	return *this;
+}
+
+// Box widths whose repeated application approximates a gaussian of the given sigma
+static std::vector<int> gaussian_box_sizes(double sigma, int passes)
+{
+	double ideal = sqrt(12 * sigma * sigma / passes + 1);
+	int lower = (int)floor(ideal);
+	if (lower % 2 == 0) lower--;
+	int upper = lower + 2;
+
+	double ideal_count = (12 * sigma * sigma - passes * lower * lower - 4 * passes * lower - 3 * passes) / (-4 * lower - 4);
+	int lower_count = (int)lround(ideal_count);
+
+	std::vector<int> sizes(passes);
+	for (int i = 0; i < passes; ++i)
+	{
+		sizes[i] = i < lower_count ? lower : upper;
+	}
+
+	return sizes;
+}
+
+// Box filter of a padded row: dst[x] averages src[x .. x + 2 * radius] per channel
+static void box_filter_row(const uint8_t* src, uint8_t* dst, int width, int channels, int radius)
+{
+	BoxDivider divide(2 * radius + 1);
+	size_t window = (size_t)(2 * radius + 1) * channels;
+	uint32_t sums[4] = { 0, 0, 0, 0 };
+
+	for (size_t i = 0; i < window; ++i)
+	{
+		sums[i % channels] += src[i];
+	}
+
+	for (int x = 0; x < width; ++x)
+	{
+		for (int channel = 0; channel < channels; ++channel)
+		{
+			size_t i = (size_t)x * channels + channel;
+			dst[i] = divide(sums[channel]);
+			if (x + 1 < width)
+				sums[channel] += src[i + window] - src[i];
+		}
+	}
+}
+
+// Box filter along Y for the byte columns [begin, end), updating one running
+// sum per column as the window slides down
+static void box_filter_columns(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride, int height, int radius, size_t begin, size_t end)
+{
+	BoxDivider divide(2 * radius + 1);
+	ScratchFrame frame;
+	uint32_t* sums = frame.alloc<uint32_t>(end - begin);
+	memset(sums, 0, (end - begin) * sizeof(uint32_t));
+
+	for (int k = -radius; k <= radius; ++k)
+	{
+		const uint8_t* row = src + get_border_values(height, k) * src_stride;
+		for (size_t i = begin; i < end; ++i)
+		{
+			sums[i - begin] += row[i];
+		}
+	}
+
+	for (int y = 0; y < height; ++y)
+	{
+		uint8_t* out = dst + y * dst_stride;
+		const uint8_t* added = src + get_border_values(height, y + radius + 1) * src_stride;
+		const uint8_t* removed = src + get_border_values(height, y - radius) * src_stride;
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			out[i] = divide(sums[i - begin]);
+			sums[i - begin] += added[i] - removed[i];
+		}
+	}
+}
+
+ImageView& ImageView::gaussian_blur_sigma(double sigma)
+{
+	// Also catches NaN, which compares false, before it reaches the box sizes
+	if (!(sigma > 0) || !std::isfinite(sigma)) return *this;
+
+	// Small kernels are cheap enough, and box filters too coarse, to convolve directly
+	if (sigma < 2)
+	{
+		int radius = (int)ceil(3 * sigma);
+		std::vector<double> kernel(2 * radius + 1);
+		double total = 0;
+
+		for (int i = -radius; i <= radius; ++i)
+		{
+			kernel[i + radius] = exp(-i * i / (2 * sigma * sigma));
+			total += kernel[i + radius];
+		}
+		for (double& k : kernel)
+		{
+			k /= total;
+		}
+
+		convolve_separable(*this, kernel);
+		return *this;
+	}
+
+	// Three box passes per axis approximate the gaussian, and running sums
+	// make the cost per pixel independent of sigma
+	std::vector<int> boxes = gaussian_box_sizes(sigma, 3);
+	size_t row_bytes = (size_t)width * channels;
+	ScratchFrame frame;
+	uint8_t* temp = frame.alloc<uint8_t>(row_bytes * height);
+
+	// Apply box filters along Y axis, alternating between the view and temp.
+	// Each worker sweeps down its own strip of columns.
+	int workers = ThreadPool::worker_count();
+	int strip = (int)std::max<size_t>(256, ((row_bytes + workers - 1) / workers + 63) & ~(size_t)63);
+
+	uint8_t* src = data;
+	ptrdiff_t src_stride = stride;
+	uint8_t* dst = temp;
+	ptrdiff_t dst_stride = row_bytes;
+	for (int box : boxes)
+	{
+		int radius = box / 2;
+		ThreadPool::instance().parallel_for((int)row_bytes, strip, [&](int begin, int end)
+		{
+			box_filter_columns(src, src_stride, dst, dst_stride, height, radius, begin, end);
+		});
+		std::swap(src, dst);
+		std::swap(src_stride, dst_stride);
+	}
+
+	// Apply box filters along X axis on mirror padded rows, ending up in the view
+	int max_radius = boxes.back() / 2;
+	parallel_rows(height, row_bytes, [&](int y_begin, int y_end)
+	{
+		ScratchFrame frame;
+		uint8_t* padded = frame.alloc<uint8_t>((size_t)(width + 2 * max_radius) * channels);
+		uint8_t* line = frame.alloc<uint8_t>(row_bytes);
+
+		for (int y = y_begin; y < y_end; ++y)
+		{
+			memcpy(line, src + y * src_stride, row_bytes);
+
+			for (int box : boxes)
+			{
+				int radius = box / 2;
+
+				memcpy(&padded[radius * channels], line, row_bytes);
+				for (int i = 1; i <= radius; ++i)
+				{
+					memcpy(&padded[(radius - i) * channels], &line[get_border_values(width, -i) * channels], channels);
+					memcpy(&padded[(radius + width - 1 + i) * channels], &line[get_border_values(width, width - 1 + i) * channels], channels);
+				}
+
+				box_filter_row(padded, line, width, channels, radius);
+			}
+
+			memcpy(row(y), line, row_bytes);
+		}
+	});
+
+	return *this;
+}
+
+ImageView& ImageView::edge_detection(double cutoff)
+{
+	grayscale_avg();
+
+	SobelStage sobel(cutoff);
+	run_row_stages(*this, *this, { &sobel });
+	return *this;
+}
+
+ImageView& ImageView::sharpen()
+{
+	SharpenStage sharpen;
+	run_row_stages(*this, *this, { &sharpen });
+	return *this;
+}
@@ -0,0 +1,144 @@
+#include "MappedFile.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : ptr(other.ptr), bytes(other.bytes)
+{
+	other.ptr = nullptr;
+	other.bytes = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		ptr = other.ptr;
+		bytes = other.bytes;
+		other.ptr = nullptr;
+		other.bytes = 0;
+	}
+
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+// Released ranges are shrunk to whole 64 KiB blocks, a multiple of the page
+// size on every supported platform
+static bool release_range(size_t bytes, size_t& offset, size_t& length)
+{
+	const size_t block = 64 * 1024;
+	size_t end = std::min(bytes, offset + length) & ~(block - 1);
+	offset = (offset + block - 1) & ~(block - 1);
+	if (offset >= end) return false;
+
+	length = end - offset;
+	return true;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size) || size.QuadPart <= 0 || (unsigned long long)size.QuadPart > SIZE_MAX)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	// The view keeps the mapping and the file open once it exists
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping) return false;
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!view) return false;
+
+	ptr = (const uint8_t*)view;
+	bytes = (size_t)size.QuadPart;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (ptr)
+		UnmapViewOfFile(ptr);
+
+	ptr = nullptr;
+	bytes = 0;
+}
+
+void MappedFile::release(size_t offset, size_t length) const
+{
+	// Unlocking pages that are not locked removes them from the working set
+	if (ptr && release_range(bytes, offset, length))
+		VirtualUnlock((void*)(ptr + offset), length);
+}
+
+#else
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+	int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0 || (unsigned long long)info.st_size > SIZE_MAX)
+	{
+		::close(fd);
+		return false;
+	}
+
+	// The mapping stays valid after the descriptor is closed
+	void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED) return false;
+
+	// Decoders read front to back, so let the kernel read ahead aggressively
+	madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+	ptr = (const uint8_t*)view;
+	bytes = (size_t)info.st_size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (ptr)
+		munmap((void*)ptr, bytes);
+
+	ptr = nullptr;
+	bytes = 0;
+}
+
+void MappedFile::release(size_t offset, size_t length) const
+{
+	// The mapping is never written, so dropped pages are read from the file again if needed
+	if (ptr && release_range(bytes, offset, length))
+		madvise((void*)(ptr + offset), length, MADV_DONTNEED);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// A whole file mapped read-only into memory, so decoders read straight from
+// the page cache instead of copying the file through stdio buffers.
+// Move-only. The file must not be truncated while it is mapped.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	// Maps filename and hints that it will be read sequentially. Returns false
+	// for files that cannot be mapped, such as empty files and pipes.
+	bool open(const char* filename);
+	void close();
+
+	// Hints that bytes [offset, offset + length) will not be read again, so
+	// their pages can leave memory now. Reading them later is still valid and
+	// faults them back in from the file.
+	void release(size_t offset, size_t length) const;
+
+	inline bool is_open() const { return ptr != nullptr; }
+	inline const uint8_t* data() const { return ptr; }
+	inline size_t size() const { return bytes; }
+
+private:
+	const uint8_t* ptr = nullptr;
+	size_t bytes = 0;
+};
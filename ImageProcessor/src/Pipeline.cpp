@@ -0,0 +1,181 @@
+#include "Pipeline.h"
+#include "Profile.h"
+#include "RowPipeline.h"
+
+using namespace std;
+
+
+const RowStage* Pipeline::Step::row_stage() const
+{
+	return points ? points.get() : stage.get();
+}
+
+PointStage& Pipeline::point_stage()
+{
+	// Consecutive per-pixel operations share a single stage
+	if (steps.empty() || !steps.back().points)
+	{
+		Step step;
+		step.points = make_shared<PointStage>();
+		steps.push_back(step);
+	}
+
+	// Copies of this pipeline made earlier must keep the operations they had
+	std::shared_ptr<PointStage>& points = steps.back().points;
+	if (points.use_count() > 1)
+		points = make_shared<PointStage>(*points);
+
+	return *points;
+}
+
+Pipeline& Pipeline::add_stage(const std::shared_ptr<RowStage>& stage)
+{
+	Step step;
+	step.stage = stage;
+	steps.push_back(step);
+	return *this;
+}
+
+Pipeline& Pipeline::add_whole(const std::function<void(Image&)>& op)
+{
+	Step step;
+	step.whole = op;
+	steps.push_back(step);
+	return *this;
+}
+
+Pipeline& Pipeline::flipX()
+{
+	return add_whole([](Image& img) { img.flipX(); });
+}
+
+Pipeline& Pipeline::flipY()
+{
+	return add_whole([](Image& img) { img.flipY(); });
+}
+
+Pipeline& Pipeline::rotate90()
+{
+	return add_whole([](Image& img) { img.rotate90(); });
+}
+
+Pipeline& Pipeline::rotate180()
+{
+	return add_whole([](Image& img) { img.rotate180(); });
+}
+
+Pipeline& Pipeline::rotate270()
+{
+	return add_whole([](Image& img) { img.rotate270(); });
+}
+
+Pipeline& Pipeline::transpose()
+{
+	return add_whole([](Image& img) { img.transpose(); });
+}
+
+Pipeline& Pipeline::crop(uint16_t start_x, uint16_t start_y, uint16_t new_height, uint16_t new_width)
+{
+	return add_whole([=](Image& img) { img.crop(start_x, start_y, new_height, new_width); });
+}
+
+Pipeline& Pipeline::resize(int new_width, int new_height, ResizeFilter filter)
+{
+	return add_whole([=](Image& img) { img.resize(new_width, new_height, filter); });
+}
+
+Pipeline& Pipeline::scale(double ratio, ResizeFilter filter)
+{
+	return add_whole([=](Image& img) { img.scale(ratio, filter); });
+}
+
+Pipeline& Pipeline::grayscale_avg()
+{
+	point_stage().add(PointStage::GRAYSCALE_AVG);
+	return *this;
+}
+
+Pipeline& Pipeline::grayscale_lum()
+{
+	point_stage().add(PointStage::GRAYSCALE_LUM);
+	return *this;
+}
+
+Pipeline& Pipeline::color_mask(float r, float g, float b)
+{
+	point_stage().add(PointStage::COLOR_MASK, make_color_mask(r, g, b));
+	return *this;
+}
+
+Pipeline& Pipeline::pixelize(int strength)
+{
+	return add_whole([=](Image& img) { img.pixelize(strength); });
+}
+
+Pipeline& Pipeline::gaussian_blur(int strength)
+{
+	return add_stage(make_shared<BlurStage>(gaussian_strength_kernel(strength)));
+}
+
+Pipeline& Pipeline::gaussian_blur_sigma(double sigma)
+{
+	// Large sigmas use running sums down whole columns, which do not stream
+	return add_whole([=](Image& img) { img.gaussian_blur_sigma(sigma); });
+}
+
+Pipeline& Pipeline::edge_detection(double cutoff)
+{
+	point_stage().add(PointStage::GRAYSCALE_AVG);
+	return add_stage(make_shared<SobelStage>(cutoff));
+}
+
+Pipeline& Pipeline::sharpen()
+{
+	return add_stage(make_shared<SharpenStage>());
+}
+
+Image& Pipeline::apply(Image& img) const
+{
+	IP_PROFILE_SCOPE("pipeline", (uint64_t)img.width * img.height);
+	std::vector<const RowStage*> pending;
+
+	auto flush = [&]()
+	{
+		if (!pending.empty())
+		{
+			// Fused stages never reach the Image timers, so the group is timed here
+			IP_PROFILE_SCOPE_NAMED(row_stages_name(pending), (uint64_t)img.width * img.height);
+			ImageView view = img.view();
+			run_row_stages(view, view, pending);
+			pending.clear();
+		}
+	};
+
+	for (const Step& step : steps)
+	{
+		if (step.whole)
+		{
+			flush();
+			step.whole(img);
+		}
+		else
+		{
+			pending.push_back(step.row_stage());
+		}
+	}
+
+	flush();
+	return img;
+}
+
+bool Pipeline::row_stages(std::vector<const RowStage*>& stages) const
+{
+	stages.clear();
+	for (const Step& step : steps)
+	{
+		if (step.whole) return false;
+		stages.push_back(step.row_stage());
+	}
+
+	return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Image.h"
+
+class RowStage;
+class PointStage;
+
+// Records a chain of operations and runs it later with as few passes over the
+// pixels as possible. Adjacent per-pixel operations (grayscaling and color
+// masks) are fused into one pass, and blur, sharpen and edge detection stream
+// rows through small rolling windows, so a whole run of such operations reads
+// and writes the image once. Operations that move pixels or change the image
+// size run on their own between those passes.
+//
+//   Pipeline recipe;
+//   recipe.grayscale_lum().gaussian_blur(2).sharpen();
+//   recipe.apply(img);
+//
+// Results are identical to calling the same Image methods one after another,
+// except that per-pixel operations skip images with fewer than 3 channels
+// without printing a warning.
+class Pipeline
+{
+public:
+	Pipeline& flipX();
+	Pipeline& flipY();
+
+	Pipeline& rotate90();
+	Pipeline& rotate180();
+	Pipeline& rotate270();
+	Pipeline& transpose();
+
+	Pipeline& crop(uint16_t start_x, uint16_t start_y, uint16_t new_height, uint16_t new_width);
+	Pipeline& resize(int new_width, int new_height, ResizeFilter filter = NEAREST);
+	Pipeline& scale(double ratio, ResizeFilter filter = NEAREST);
+
+	Pipeline& grayscale_avg();
+	Pipeline& grayscale_lum();
+
+	Pipeline& color_mask(float r, float g, float b);
+
+	Pipeline& pixelize(int strength = 2);
+
+	Pipeline& gaussian_blur(int strength = 2);
+	Pipeline& gaussian_blur_sigma(double sigma);
+	Pipeline& edge_detection(double cutoff = 115);
+	Pipeline& sharpen();
+
+	inline bool empty() const { return steps.empty(); }
+
+	// Runs the recorded operations on img, in place
+	Image& apply(Image& img) const;
+
+	// The recorded operations as row stages, for images streamed a strip at a
+	// time. Returns false if any operation needs the whole image (flips, rotations, crop,
+	// resize, scale, pixelize and blur by sigma)
+	bool row_stages(std::vector<const RowStage*>& stages) const;
+
+private:
+	// Either a stage streamed with its neighbours, a run of fused per-pixel
+	// operations, or an operation on the whole image. Stages are shared between
+	// copies of a Pipeline, so a point stage is copied before it is extended.
+	struct Step
+	{
+		std::shared_ptr<RowStage> stage;
+		std::shared_ptr<PointStage> points;
+		std::function<void(Image&)> whole;
+
+		const RowStage* row_stage() const;
+	};
+
+	PointStage& point_stage();
+	Pipeline& add_stage(const std::shared_ptr<RowStage>& stage);
+	Pipeline& add_whole(const std::function<void(Image&)>& op);
+
+	std::vector<Step> steps;
+};
@@ -0,0 +1,77 @@
+#include "PixelBuffer.h"
+#include "Profile.h"
+#include <cstring>
+#include <new>
+
+void* pixel_alloc(size_t size)
+{
+	IP_PROFILE_ALLOCATION(size);
+	return ::operator new(size ? size : 1, std::align_val_t(PixelBuffer::ALIGNMENT), std::nothrow);
+}
+
+void* pixel_realloc(void* p, size_t old_size, size_t new_size)
+{
+	void* resized = pixel_alloc(new_size);
+	if (resized && p)
+	{
+		memcpy(resized, p, old_size < new_size ? old_size : new_size);
+		pixel_free(p);
+	}
+
+	return resized;
+}
+
+void pixel_free(void* p)
+{
+	if (p)
+		::operator delete(p, std::align_val_t(PixelBuffer::ALIGNMENT), std::nothrow);
+}
+
+PixelBuffer::PixelBuffer(size_t size)
+{
+	ptr = (uint8_t*)pixel_alloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	bytes = size;
+}
+
+PixelBuffer::PixelBuffer(PixelBuffer&& other) noexcept : ptr(other.ptr), bytes(other.bytes)
+{
+	other.ptr = nullptr;
+	other.bytes = 0;
+}
+
+PixelBuffer& PixelBuffer::operator=(PixelBuffer&& other) noexcept
+{
+	if (this != &other)
+	{
+		reset();
+		ptr = other.ptr;
+		bytes = other.bytes;
+		other.ptr = nullptr;
+		other.bytes = 0;
+	}
+
+	return *this;
+}
+
+PixelBuffer::~PixelBuffer()
+{
+	reset();
+}
+
+PixelBuffer PixelBuffer::adopt(uint8_t* data, size_t size)
+{
+	PixelBuffer buffer;
+	buffer.ptr = data;
+	buffer.bytes = data ? size : 0;
+	return buffer;
+}
+
+void PixelBuffer::reset()
+{
+	pixel_free(ptr);
+	ptr = nullptr;
+	bytes = 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Allocator behind every pixel buffer, including the ones stb_image decodes
+// into, so any buffer an Image holds is released the same way. Returns
+// 64-byte aligned memory, or nullptr on failure.
+void* pixel_alloc(size_t size);
+void* pixel_realloc(void* p, size_t old_size, size_t new_size);
+void pixel_free(void* p);
+
+// Owned, 64-byte aligned block of pixels. Move-only, so large frames are
+// never copied by accident.
+class PixelBuffer
+{
+public:
+	static const size_t ALIGNMENT = 64;
+
+	PixelBuffer() = default;
+	explicit PixelBuffer(size_t size);
+	PixelBuffer(PixelBuffer&& other) noexcept;
+	PixelBuffer& operator=(PixelBuffer&& other) noexcept;
+	PixelBuffer(const PixelBuffer&) = delete;
+	PixelBuffer& operator=(const PixelBuffer&) = delete;
+	~PixelBuffer();
+
+	// Takes ownership of memory returned by pixel_alloc
+	static PixelBuffer adopt(uint8_t* data, size_t size);
+
+	inline uint8_t* data() const { return ptr; }
+	inline size_t size() const { return bytes; }
+
+	void reset();
+
+private:
+	uint8_t* ptr = nullptr;
+	size_t bytes = 0;
+};
@@ -0,0 +1,197 @@
+#include "PngEncoder.h"
+#include "ThreadPool.h"
+#include "stb_image_write.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Filtered bytes deflated as one piece of the stream
+static const size_t BAND_BYTES = 256 * 1024;
+
+static const uint32_t ADLER_BASE = 65521;
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t length)
+{
+	static const struct Table
+	{
+		uint32_t entries[256];
+
+		Table()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k)
+					c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				entries[i] = c;
+			}
+		}
+	} table;
+
+	crc = ~crc;
+	for (size_t i = 0; i < length; ++i)
+	{
+		crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t length)
+{
+	uint32_t s1 = 1, s2 = 0;
+	while (length > 0)
+	{
+		// The largest run that cannot overflow s2 before the modulo
+		size_t run = std::min<size_t>(length, 5552);
+		for (size_t i = 0; i < run; ++i)
+		{
+			s1 += data[i];
+			s2 += s1;
+		}
+		s1 %= ADLER_BASE;
+		s2 %= ADLER_BASE;
+		data += run;
+		length -= run;
+	}
+	return s2 << 16 | s1;
+}
+
+// Adler-32 of two pieces of data joined, from the checksum of each
+static uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_length)
+{
+	uint32_t rem = (uint32_t)(second_length % ADLER_BASE);
+	uint32_t s1 = first & 0xffff;
+	uint32_t s2 = (uint32_t)((uint64_t)rem * s1 % ADLER_BASE);
+	s1 += (second & 0xffff) + ADLER_BASE - 1;
+	s2 += (first >> 16) + (second >> 16) + ADLER_BASE - rem;
+	if (s1 >= ADLER_BASE) s1 -= ADLER_BASE;
+	if (s1 >= ADLER_BASE) s1 -= ADLER_BASE;
+	if (s2 >= ADLER_BASE * 2) s2 -= ADLER_BASE * 2;
+	if (s2 >= ADLER_BASE) s2 -= ADLER_BASE;
+	return s2 << 16 | s1;
+}
+
+static void put32be(std::vector<uint8_t>& out, uint32_t v)
+{
+	out.push_back((uint8_t)(v >> 24));
+	out.push_back((uint8_t)(v >> 16));
+	out.push_back((uint8_t)(v >> 8));
+	out.push_back((uint8_t)v);
+}
+
+// Finishes a chunk whose length, type and data have been appended at `start`
+// by filling in the length and appending the CRC of the type and data
+static void end_chunk(std::vector<uint8_t>& out, size_t start)
+{
+	uint32_t length = (uint32_t)(out.size() - start - 8);
+	for (int i = 0; i < 4; ++i)
+	{
+		out[start + i] = (uint8_t)(length >> (24 - 8 * i));
+	}
+	put32be(out, crc32(0, &out[start + 4], length + 4));
+}
+
+static void begin_chunk(std::vector<uint8_t>& out, const char* type)
+{
+	put32be(out, 0);
+	out.insert(out.end(), type, type + 4);
+}
+
+bool encode_png(const uint8_t* pixels, int width, int height, int channels, int level, int filter, const std::function<void(const uint8_t*, size_t)>& write)
+{
+	if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4) return false;
+
+	size_t row_bytes = (size_t)width * channels;
+	size_t filtered_row = row_bytes + 1;
+	int band_rows = (int)std::max<size_t>(1, BAND_BYTES / filtered_row);
+	int band_count = (height + band_rows - 1) / band_rows;
+
+	// stb sizes buffers with ints
+	if (filtered_row * band_rows > INT32_MAX) return false;
+
+	struct Band
+	{
+		std::vector<uint8_t> chunk; // The whole IDAT chunk, CRC included except for the last band
+		uint32_t adler = 0;
+		size_t length = 0;          // Filtered bytes
+	};
+
+	std::vector<Band> bands(band_count);
+	std::atomic<bool> failed(false);
+
+	ThreadPool::instance().parallel_for(band_count, 1, [&](int begin, int end)
+	{
+		std::vector<uint8_t> filtered;
+		for (int index = begin; index < end && !failed; ++index)
+		{
+			Band& band = bands[index];
+			int y0 = index * band_rows;
+			int y1 = std::min(height, y0 + band_rows);
+			bool last = index == band_count - 1;
+
+			band.length = filtered_row * (y1 - y0);
+			filtered.resize(band.length);
+			stbi_write_png_filter_rows(pixels, (int)row_bytes, width, height, channels, y0, y1, filter, filtered.data());
+			band.adler = adler32(filtered.data(), band.length);
+
+			int compressed_length = 0;
+			uint8_t* compressed = stbi_zlib_compress_part(filtered.data(), (int)band.length, &compressed_length, level, last);
+			if (!compressed)
+			{
+				failed = true;
+				break;
+			}
+
+			begin_chunk(band.chunk, "IDAT");
+			if (index == 0)
+			{
+				band.chunk.push_back(0x78); // Deflate with a 32K window
+				band.chunk.push_back(0x5e);
+			}
+			band.chunk.insert(band.chunk.end(), compressed, compressed + compressed_length);
+			free(compressed);
+
+			// The last chunk still needs the checksum of the whole stream
+			if (!last)
+				end_chunk(band.chunk, 0);
+		}
+	});
+
+	if (failed) return false;
+
+	uint32_t adler = bands[0].adler;
+	for (int i = 1; i < band_count; ++i)
+	{
+		adler = adler32_combine(adler, bands[i].adler, bands[i].length);
+	}
+	Band& last = bands.back();
+	put32be(last.chunk, adler);
+	end_chunk(last.chunk, 0);
+
+	static const uint8_t color_types[5] = { 0, 0, 4, 2, 6 };
+	static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	std::vector<uint8_t> header(signature, signature + 8);
+	begin_chunk(header, "IHDR");
+	put32be(header, (uint32_t)width);
+	put32be(header, (uint32_t)height);
+	header.push_back(8); // Bits per sample
+	header.push_back(color_types[channels]);
+	header.push_back(0); // Deflate
+	header.push_back(0); // Adaptive filtering
+	header.push_back(0); // Not interlaced
+	end_chunk(header, 8);
+	write(header.data(), header.size());
+
+	for (const Band& band : bands)
+	{
+		write(band.chunk.data(), band.chunk.size());
+	}
+
+	std::vector<uint8_t> end;
+	begin_chunk(end, "IEND");
+	end_chunk(end, 0);
+	write(end.data(), end.size());
+	return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Encodes 8-bit pixels with 1 to 4 channels as a PNG, passing the file to
+// `write` in order, a piece at a time. `level` is stb's compression level (1
+// to 9 and up, higher is smaller and slower) and `filter` either -1 to pick
+// each row's filter as stbi_write_png does, or 0 to 4 (none, sub, up, average,
+// Paeth) to use one for every row. Filtered rows are compressed in bands of
+// about 256 KiB on the thread pool. Each band is deflated as its own piece of
+// a single zlib stream (as pigz does) and stored in its own IDAT chunk. The
+// bands' Adler-32 checksums are combined, so any PNG reader decodes the
+// result. The band size does not depend on the thread count, so neither does
+// the output. Matches cannot reach back across a band boundary, which makes
+// photographs 0.1 to 0.7% larger. Returns false if the encoder fails, for
+// example when out of memory.
+bool encode_png(const uint8_t* pixels, int width, int height, int channels, int level, int filter, const std::function<void(const uint8_t*, size_t)>& write);
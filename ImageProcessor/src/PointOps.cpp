@@ -0,0 +1,366 @@
+#include "PointOps.h"
+#include "Simd.h"
+#include <cmath>
+
+// (r + g + b) * AVG_MULTIPLIER >> 16 equals (r + g + b) / 3 for every sum of three bytes
+static const uint32_t AVG_MULTIPLIER = 21846;
+
+// Rec. 709 luma weights 0.2126, 0.7152 and 0.0722 in 0.15 fixed point. They
+// sum to exactly 1, so every neutral gray maps to itself
+static const int LUM_SHIFT = 15;
+static const uint32_t LUM_R = 6966;
+static const uint32_t LUM_G = 23436;
+static const uint32_t LUM_B = 2366;
+
+static const int MASK_SHIFT = 12;
+
+static inline uint8_t gray_avg(uint32_t r, uint32_t g, uint32_t b)
+{
+	return (uint8_t)(((r + g + b) * AVG_MULTIPLIER) >> 16);
+}
+
+// The weighted sum is rounded once, exactly like the vector kernels
+static inline uint8_t gray_lum(uint32_t r, uint32_t g, uint32_t b)
+{
+	return (uint8_t)((r * LUM_R + g * LUM_G + b * LUM_B + (1 << (LUM_SHIFT - 1))) >> LUM_SHIFT);
+}
+
+static inline uint8_t masked(uint32_t value, uint32_t factor)
+{
+	uint32_t result = (value * factor) >> MASK_SHIFT;
+	return (uint8_t)(result > 255 ? 255 : result);
+}
+
+static void grayscale_row_scalar(uint8_t* row, int start, int width, int channels, bool luminance)
+{
+	for (int x = start; x < width; ++x)
+	{
+		uint8_t* px = row + x * channels;
+		uint8_t gray = luminance ? gray_lum(px[0], px[1], px[2]) : gray_avg(px[0], px[1], px[2]);
+		px[0] = px[1] = px[2] = gray;
+	}
+}
+
+static void color_mask_row_scalar(uint8_t* row, int start, int width, int channels, const ColorMask& mask)
+{
+	for (int x = start; x < width; ++x)
+	{
+		uint8_t* px = row + x * channels;
+		px[0] = masked(px[0], mask.factors[0]);
+		px[1] = masked(px[1], mask.factors[1]);
+		px[2] = masked(px[2], mask.factors[2]);
+	}
+}
+
+#if IP_X86
+
+// 16 interleaved pixels span `channels` 16-byte blocks. These byte shuffles
+// split them into one vector per color channel and merge results back.
+struct ShuffleTables
+{
+	// gather[c][b] moves channel c of the pixels stored in block b to its lane
+	alignas(16) uint8_t gather[3][4][16];
+	// scatter[b] copies each pixel's gray value to its color bytes in block b
+	alignas(16) uint8_t scatter[4][16];
+	// color[b] is 0xFF on the color bytes of block b and 0 on alpha bytes
+	alignas(16) uint8_t color[4][16];
+};
+
+static ShuffleTables make_shuffle_tables(int channels)
+{
+	ShuffleTables tables;
+
+	for (int b = 0; b < 4; ++b)
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				int src = i * channels + c;
+				tables.gather[c][b][i] = src / 16 == b ? (uint8_t)(src % 16) : 0x80;
+			}
+
+			int byte = b * 16 + i;
+			bool is_color = byte % channels < 3;
+			tables.scatter[b][i] = is_color ? (uint8_t)(byte / channels) : 0x80;
+			tables.color[b][i] = is_color ? 0xFF : 0;
+		}
+	}
+
+	return tables;
+}
+
+static const ShuffleTables& shuffle_tables(int channels)
+{
+	static const ShuffleTables rgb = make_shuffle_tables(3);
+	static const ShuffleTables rgba = make_shuffle_tables(4);
+	return channels == 3 ? rgb : rgba;
+}
+
+IP_TARGET_SSE41 static inline __m128i gather_channel(const __m128i* blocks, const ShuffleTables& tables, int c, int channels)
+{
+	__m128i out = _mm_setzero_si128();
+	for (int b = 0; b < channels; ++b)
+	{
+		out = _mm_or_si128(out, _mm_shuffle_epi8(blocks[b], _mm_load_si128((const __m128i*)tables.gather[c][b])));
+	}
+	return out;
+}
+
+IP_TARGET_SSE41 static inline void scatter_gray(uint8_t* dst, const __m128i* blocks, __m128i gray, const ShuffleTables& tables, int channels)
+{
+	for (int b = 0; b < channels; ++b)
+	{
+		__m128i spread = _mm_shuffle_epi8(gray, _mm_load_si128((const __m128i*)tables.scatter[b]));
+		if (channels == 4)
+			spread = _mm_blendv_epi8(blocks[b], spread, _mm_load_si128((const __m128i*)tables.color[b]));
+		_mm_storeu_si128((__m128i*)(dst + b * 16), spread);
+	}
+}
+
+// Luma of 4 pixels: r and g are interleaved in rg, b and a constant 1 in b1,
+// so two multiply-adds give the whole weighted sum plus the rounding bias
+IP_TARGET_SSE41 static inline __m128i luma_epi32(__m128i rg, __m128i b1)
+{
+	const __m128i w_rg = _mm_set1_epi32((int)(LUM_R | LUM_G << 16));
+	const __m128i w_b1 = _mm_set1_epi32((int)(LUM_B | 1u << (LUM_SHIFT - 1) << 16));
+	__m128i sum = _mm_add_epi32(_mm_madd_epi16(rg, w_rg), _mm_madd_epi16(b1, w_b1));
+	return _mm_srli_epi32(sum, LUM_SHIFT);
+}
+
+// Luma of 8 pixels whose channels are held in 16-bit lanes
+IP_TARGET_SSE41 static inline __m128i luma_epi16(__m128i r, __m128i g, __m128i b)
+{
+	const __m128i one = _mm_set1_epi16(1);
+	__m128i lo = luma_epi32(_mm_unpacklo_epi16(r, g), _mm_unpacklo_epi16(b, one));
+	__m128i hi = luma_epi32(_mm_unpackhi_epi16(r, g), _mm_unpackhi_epi16(b, one));
+	return _mm_packs_epi32(lo, hi);
+}
+
+IP_TARGET_AVX2 static inline __m256i luma_epi16_avx2(__m256i r, __m256i g, __m256i b)
+{
+	// Unpacking and packing stay within each 128-bit half, so the pixel order is kept
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i w_rg = _mm256_set1_epi32((int)(LUM_R | LUM_G << 16));
+	const __m256i w_b1 = _mm256_set1_epi32((int)(LUM_B | 1u << (LUM_SHIFT - 1) << 16));
+	__m256i lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), w_rg), _mm256_madd_epi16(_mm256_unpacklo_epi16(b, one), w_b1));
+	__m256i hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), w_rg), _mm256_madd_epi16(_mm256_unpackhi_epi16(b, one), w_b1));
+	return _mm256_packs_epi32(_mm256_srli_epi32(lo, LUM_SHIFT), _mm256_srli_epi32(hi, LUM_SHIFT));
+}
+
+IP_TARGET_SSE41 static int grayscale_row_sse41(uint8_t* row, int width, int channels, bool luminance)
+{
+	const ShuffleTables& tables = shuffle_tables(channels);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i avg = _mm_set1_epi16((short)AVG_MULTIPLIER);
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		uint8_t* px = row + x * channels;
+		__m128i blocks[4];
+		for (int b = 0; b < channels; ++b)
+		{
+			blocks[b] = _mm_loadu_si128((const __m128i*)(px + b * 16));
+		}
+
+		__m128i r = gather_channel(blocks, tables, 0, channels);
+		__m128i g = gather_channel(blocks, tables, 1, channels);
+		__m128i bl = gather_channel(blocks, tables, 2, channels);
+		__m128i lo, hi;
+
+		if (luminance)
+		{
+			lo = luma_epi16(_mm_cvtepu8_epi16(r), _mm_cvtepu8_epi16(g), _mm_cvtepu8_epi16(bl));
+			hi = luma_epi16(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(bl, zero));
+		}
+		else
+		{
+			lo = _mm_add_epi16(_mm_add_epi16(_mm_cvtepu8_epi16(r), _mm_cvtepu8_epi16(g)), _mm_cvtepu8_epi16(bl));
+			hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero)), _mm_unpackhi_epi8(bl, zero));
+			lo = _mm_mulhi_epu16(lo, avg);
+			hi = _mm_mulhi_epu16(hi, avg);
+		}
+
+		scatter_gray(px, blocks, _mm_packus_epi16(lo, hi), tables, channels);
+	}
+
+	return x;
+}
+
+IP_TARGET_AVX2 static int grayscale_row_avx2(uint8_t* row, int width, int channels, bool luminance)
+{
+	const ShuffleTables& tables = shuffle_tables(channels);
+	const __m256i avg = _mm256_set1_epi16((short)AVG_MULTIPLIER);
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		uint8_t* px = row + x * channels;
+		__m128i blocks[4];
+		for (int b = 0; b < channels; ++b)
+		{
+			blocks[b] = _mm_loadu_si128((const __m128i*)(px + b * 16));
+		}
+
+		// All 16 pixels fit one register once widened to 16 bits
+		__m256i r = _mm256_cvtepu8_epi16(gather_channel(blocks, tables, 0, channels));
+		__m256i g = _mm256_cvtepu8_epi16(gather_channel(blocks, tables, 1, channels));
+		__m256i bl = _mm256_cvtepu8_epi16(gather_channel(blocks, tables, 2, channels));
+		__m256i gray;
+
+		if (luminance)
+			gray = luma_epi16_avx2(r, g, bl);
+		else
+			gray = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_add_epi16(r, g), bl), avg);
+
+		__m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(gray), _mm256_extracti128_si256(gray, 1));
+		scatter_gray(px, blocks, packed, tables, channels);
+	}
+
+	return x;
+}
+
+// Factors for every byte of `channels` consecutive 16-byte blocks
+struct MaskFactors
+{
+	alignas(32) uint16_t factors[4][16];
+};
+
+static MaskFactors expand_mask(const ColorMask& mask, int channels)
+{
+	MaskFactors expanded;
+	for (int i = 0; i < 64; ++i)
+	{
+		int c = i % channels;
+		expanded.factors[i / 16][i % 16] = c < 3 ? mask.factors[c] : (uint16_t)(1 << MASK_SHIFT);
+	}
+	return expanded;
+}
+
+// min((v * f) >> 12, 255) on 16-bit lanes from the high and low product halves
+IP_TARGET_SSE41 static inline __m128i mask_lanes(__m128i v, __m128i f)
+{
+	__m128i hi = _mm_slli_epi16(_mm_mulhi_epu16(v, f), 16 - MASK_SHIFT);
+	__m128i lo = _mm_srli_epi16(_mm_mullo_epi16(v, f), MASK_SHIFT);
+	return _mm_min_epu16(_mm_or_si128(hi, lo), _mm_set1_epi16(255));
+}
+
+IP_TARGET_SSE41 static int color_mask_row_sse41(uint8_t* row, int width, int channels, const ColorMask& mask)
+{
+	MaskFactors expanded = expand_mask(mask, channels);
+	const __m128i zero = _mm_setzero_si128();
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		uint8_t* px = row + x * channels;
+		for (int b = 0; b < channels; ++b)
+		{
+			__m128i block = _mm_loadu_si128((const __m128i*)(px + b * 16));
+			__m128i lo = mask_lanes(_mm_cvtepu8_epi16(block), _mm_load_si128((const __m128i*)&expanded.factors[b][0]));
+			__m128i hi = mask_lanes(_mm_unpackhi_epi8(block, zero), _mm_load_si128((const __m128i*)&expanded.factors[b][8]));
+			_mm_storeu_si128((__m128i*)(px + b * 16), _mm_packus_epi16(lo, hi));
+		}
+	}
+
+	return x;
+}
+
+IP_TARGET_AVX2 static int color_mask_row_avx2(uint8_t* row, int width, int channels, const ColorMask& mask)
+{
+	MaskFactors expanded = expand_mask(mask, channels);
+	const __m256i limit = _mm256_set1_epi16(255);
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		uint8_t* px = row + x * channels;
+		for (int b = 0; b < channels; ++b)
+		{
+			__m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(px + b * 16)));
+			__m256i f = _mm256_load_si256((const __m256i*)expanded.factors[b]);
+			__m256i hi = _mm256_slli_epi16(_mm256_mulhi_epu16(v, f), 16 - MASK_SHIFT);
+			__m256i lo = _mm256_srli_epi16(_mm256_mullo_epi16(v, f), MASK_SHIFT);
+			__m256i result = _mm256_min_epu16(_mm256_or_si256(hi, lo), limit);
+			_mm_storeu_si128((__m128i*)(px + b * 16), _mm_packus_epi16(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1)));
+		}
+	}
+
+	return x;
+}
+
+#endif
+
+static void grayscale_row(uint8_t* row, int width, int channels, bool luminance)
+{
+	int done = 0;
+
+#if IP_X86
+	if (channels == 3 || channels == 4)
+	{
+		switch (simd_level())
+		{
+		case SIMD_AVX2:
+			done = grayscale_row_avx2(row, width, channels, luminance);
+			break;
+		case SIMD_SSE41:
+			done = grayscale_row_sse41(row, width, channels, luminance);
+			break;
+		default:
+			break;
+		}
+	}
+#endif
+
+	grayscale_row_scalar(row, done, width, channels, luminance);
+}
+
+void grayscale_avg_row(uint8_t* row, int width, int channels)
+{
+	grayscale_row(row, width, channels, false);
+}
+
+void grayscale_lum_row(uint8_t* row, int width, int channels)
+{
+	grayscale_row(row, width, channels, true);
+}
+
+ColorMask make_color_mask(float r, float g, float b)
+{
+	float values[3] = { r, g, b };
+	ColorMask mask;
+
+	for (int c = 0; c < 3; ++c)
+	{
+		float scaled = values[c] * (1 << MASK_SHIFT);
+		mask.factors[c] = (uint16_t)(scaled <= 0 ? 0 : (scaled >= 65535 ? 65535 : lround(scaled)));
+	}
+	mask.factors[3] = 1 << MASK_SHIFT;
+
+	return mask;
+}
+
+void color_mask_row(uint8_t* row, int width, int channels, const ColorMask& mask)
+{
+	int done = 0;
+
+#if IP_X86
+	if (channels == 3 || channels == 4)
+	{
+		switch (simd_level())
+		{
+		case SIMD_AVX2:
+			done = color_mask_row_avx2(row, width, channels, mask);
+			break;
+		case SIMD_SSE41:
+			done = color_mask_row_sse41(row, width, channels, mask);
+			break;
+		default:
+			break;
+		}
+	}
+#endif
+
+	color_mask_row_scalar(row, done, width, channels, mask);
+}
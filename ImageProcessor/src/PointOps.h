@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+
+// Per-pixel kernels over one row of interleaved pixels with at least 3
+// channels. RGB and RGBA rows are processed 16 pixels at a time with SSE4.1 or
+// AVX2 when the CPU supports it. Every path uses the same fixed-point
+// arithmetic, so results do not depend on the instruction set.
+
+void grayscale_avg_row(uint8_t* row, int width, int channels);
+void grayscale_lum_row(uint8_t* row, int width, int channels);
+
+// Multipliers for color_mask_row in 4.12 fixed point (alpha is left as is)
+struct ColorMask
+{
+	uint16_t factors[4];
+};
+
+ColorMask make_color_mask(float r, float g, float b);
+void color_mask_row(uint8_t* row, int width, int channels, const ColorMask& mask);
@@ -0,0 +1,416 @@
+#include "Profile.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#if IP_PROFILE
+
+// Events kept per thread for the trace. Totals keep counting past it
+static const size_t MAX_EVENTS = 1 << 18;
+
+// Histogram bucket i counts calls of [2^i, 2^(i+1)) microseconds, the first
+// one everything under 2 us and the last everything from about 1 hour
+static const int BUCKETS = 32;
+
+struct ProfileEvent
+{
+	const char* name;
+	uint64_t start; // Nanoseconds since the first timer
+	uint64_t duration;
+	uint64_t pixels;
+	uint64_t allocated;
+};
+
+struct OpTotals
+{
+	const char* name;
+	uint64_t calls = 0;
+	uint64_t total = 0;
+	uint64_t min = UINT64_MAX;
+	uint64_t max = 0;
+	uint64_t pixels = 0;
+	uint64_t allocated = 0;
+	uint64_t histogram[BUCKETS] = {};
+
+	void add(uint64_t duration, uint64_t pixel_count, uint64_t bytes)
+	{
+		++calls;
+		total += duration;
+		min = std::min(min, duration);
+		max = std::max(max, duration);
+		pixels += pixel_count;
+		allocated += bytes;
+
+		int bucket = 0;
+		for (uint64_t us = duration / 1000; us > 1 && bucket + 1 < BUCKETS; us >>= 1)
+		{
+			++bucket;
+		}
+		++histogram[bucket];
+	}
+
+	void merge(const OpTotals& other)
+	{
+		calls += other.calls;
+		total += other.total;
+		min = std::min(min, other.min);
+		max = std::max(max, other.max);
+		pixels += other.pixels;
+		allocated += other.allocated;
+		for (int i = 0; i < BUCKETS; ++i)
+		{
+			histogram[i] += other.histogram[i];
+		}
+	}
+};
+
+// Totals by operation name. Names are literals, so they are matched by
+// address on the hot path and by content when logs are combined
+static OpTotals& totals_for(std::vector<OpTotals>& ops, const char* name, bool by_content)
+{
+	for (OpTotals& op : ops)
+	{
+		if (op.name == name || (by_content && strcmp(op.name, name) == 0))
+			return op;
+	}
+
+	ops.emplace_back();
+	ops.back().name = name;
+	return ops.back();
+}
+
+// What one thread recorded. The owning thread appends under the log's own
+// mutex, which only the exporting functions contend for
+struct ThreadLog
+{
+	int id = 0;
+	std::mutex mutex;
+	std::vector<ProfileEvent> events;
+	std::vector<OpTotals> ops;
+	uint64_t dropped = 0;
+	uint64_t allocated = 0; // Running count, only touched by the owner
+
+	ThreadLog();
+	~ThreadLog();
+};
+
+// Every live thread's log, and what threads that have exited recorded
+struct Registry
+{
+	std::mutex mutex;
+	std::vector<ThreadLog*> logs;
+	int next_thread_id = 1;
+	std::set<std::string> names; // Interned, never erased
+
+	std::vector<ProfileEvent> retired_events;
+	std::vector<std::pair<int, size_t>> retired_threads; // Thread id and event count
+	std::vector<OpTotals> retired_ops;
+	uint64_t retired_dropped = 0;
+};
+
+static std::atomic<bool> recording(false);
+
+// Never destroyed, as pool workers can still exit after static destructors ran
+static Registry& registry()
+{
+	static Registry* instance = new Registry;
+	return *instance;
+}
+
+static uint64_t now_ns()
+{
+	static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+ThreadLog::ThreadLog()
+{
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	id = r.next_thread_id++;
+	r.logs.push_back(this);
+}
+
+ThreadLog::~ThreadLog()
+{
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	r.logs.erase(std::find(r.logs.begin(), r.logs.end(), this));
+
+	if (!events.empty())
+	{
+		r.retired_threads.emplace_back(id, events.size());
+		r.retired_events.insert(r.retired_events.end(), events.begin(), events.end());
+	}
+	for (const OpTotals& op : ops)
+	{
+		totals_for(r.retired_ops, op.name, true).merge(op);
+	}
+	r.retired_dropped += dropped;
+}
+
+static ThreadLog& local_log()
+{
+	static thread_local ThreadLog log;
+	return log;
+}
+
+const char* profile_intern(const std::string& name)
+{
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	return r.names.insert(name).first->c_str();
+}
+
+void profile_count_allocation(size_t size)
+{
+	if (recording.load(std::memory_order_relaxed))
+		local_log().allocated += size;
+}
+
+ProfileScope::ProfileScope(const char* name, uint64_t pixels) : name(nullptr), pixels(pixels), start(0), allocated(0)
+{
+	if (!name || !recording.load(std::memory_order_relaxed)) return;
+
+	this->name = name;
+	allocated = local_log().allocated;
+	start = now_ns();
+}
+
+ProfileScope::~ProfileScope()
+{
+	if (!name) return;
+
+	uint64_t end = now_ns();
+	ThreadLog& log = local_log();
+	uint64_t bytes = log.allocated - allocated;
+
+	std::lock_guard<std::mutex> lock(log.mutex);
+	if (log.events.size() < MAX_EVENTS)
+		log.events.push_back({ name, start, end - start, pixels, bytes });
+	else
+		++log.dropped;
+
+	totals_for(log.ops, name, false).add(end - start, pixels, bytes);
+}
+
+void profile_set_enabled(bool enabled)
+{
+	// Start the clock now rather than in the first timer
+	now_ns();
+	recording = enabled;
+}
+
+bool profile_enabled()
+{
+	return recording;
+}
+
+void profile_reset()
+{
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	for (ThreadLog* log : r.logs)
+	{
+		std::lock_guard<std::mutex> log_lock(log->mutex);
+		log->events.clear();
+		log->ops.clear();
+		log->dropped = 0;
+	}
+
+	r.retired_events.clear();
+	r.retired_threads.clear();
+	r.retired_ops.clear();
+	r.retired_dropped = 0;
+}
+
+// Every thread's totals combined, busiest operation first
+static std::vector<OpTotals> combined_totals(uint64_t& dropped)
+{
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	std::vector<OpTotals> ops;
+	dropped = r.retired_dropped;
+
+	for (const OpTotals& op : r.retired_ops)
+	{
+		totals_for(ops, op.name, true).merge(op);
+	}
+	for (ThreadLog* log : r.logs)
+	{
+		std::lock_guard<std::mutex> log_lock(log->mutex);
+		for (const OpTotals& op : log->ops)
+		{
+			totals_for(ops, op.name, true).merge(op);
+		}
+		dropped += log->dropped;
+	}
+
+	std::sort(ops.begin(), ops.end(), [](const OpTotals& a, const OpTotals& b) { return a.total > b.total; });
+	return ops;
+}
+
+static void write_event(std::ofstream& out, const ProfileEvent& event, int thread, bool& first)
+{
+	// Trace timestamps are in microseconds. Names of fused groups can be of
+	// any length, so they are written separately
+	char line[256];
+	snprintf(line, sizeof(line), "\",\"cat\":\"image\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+		"\"args\":{\"pixels\":%llu,\"bytes_allocated\":%llu}}",
+		thread, event.start / 1000.0, event.duration / 1000.0,
+		(unsigned long long)event.pixels, (unsigned long long)event.allocated);
+	out << (first ? "" : ",") << "\n{\"name\":\"" << event.name << line;
+	first = false;
+}
+
+static void write_thread_name(std::ofstream& out, int thread, bool& first)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+		first ? "" : ",", thread, thread);
+	out << line;
+	first = false;
+}
+
+bool profile_write_trace(const char* filename)
+{
+	std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+	if (!out) return false;
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+
+	{
+		Registry& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+
+		size_t offset = 0;
+		for (const std::pair<int, size_t>& thread : r.retired_threads)
+		{
+			write_thread_name(out, thread.first, first);
+			for (size_t i = 0; i < thread.second; ++i)
+			{
+				write_event(out, r.retired_events[offset + i], thread.first, first);
+			}
+			offset += thread.second;
+		}
+
+		for (ThreadLog* log : r.logs)
+		{
+			std::lock_guard<std::mutex> log_lock(log->mutex);
+			if (log->events.empty()) continue;
+
+			write_thread_name(out, log->id, first);
+			for (const ProfileEvent& event : log->events)
+			{
+				write_event(out, event, log->id, first);
+			}
+		}
+	}
+
+	out << "\n]}\n";
+	out.close();
+	return !out.fail();
+}
+
+// "3 us", "1 ms", "2 s": the lower bound of a histogram bucket
+static std::string bucket_label(int bucket)
+{
+	uint64_t us = bucket == 0 ? 0 : (uint64_t)1 << bucket;
+	char label[32];
+	if (us < 1000)
+		snprintf(label, sizeof(label), "%llu us", (unsigned long long)us);
+	else if (us < 1000000)
+		snprintf(label, sizeof(label), "%.3g ms", us / 1e3);
+	else
+		snprintf(label, sizeof(label), "%.3g s", us / 1e6);
+	return label;
+}
+
+std::string profile_summary()
+{
+	uint64_t dropped = 0;
+	std::vector<OpTotals> ops = combined_totals(dropped);
+	if (ops.empty())
+		return "No operations recorded\n";
+
+	// Fused pipeline groups are named after all their operations, so the
+	// name column grows to fit them
+	int name_width = 20;
+	for (const OpTotals& op : ops)
+	{
+		name_width = std::max(name_width, (int)strlen(op.name));
+	}
+
+	std::string text;
+	std::vector<char> line(name_width + 256);
+	snprintf(line.data(), line.size(), "%-*s %8s %12s %10s %10s %10s %10s %12s\n",
+		name_width, "op", "calls", "total ms", "mean ms", "min ms", "max ms", "MP/s", "alloc MB");
+	text += line.data();
+
+	for (const OpTotals& op : ops)
+	{
+		double total_ms = op.total / 1e6;
+		double mpix_per_s = op.total ? op.pixels / 1e6 / (op.total / 1e9) : 0;
+		snprintf(line.data(), line.size(), "%-*s %8llu %12.3f %10.3f %10.3f %10.3f %10.1f %12.2f\n",
+			name_width, op.name, (unsigned long long)op.calls, total_ms, total_ms / op.calls, op.min / 1e6, op.max / 1e6,
+			mpix_per_s, op.allocated / 1e6);
+		text += line.data();
+	}
+
+	// Calls per power-of-two time bucket, from each op's fastest to slowest
+	text += "\nCalls by duration (bucket starts):\n";
+	for (const OpTotals& op : ops)
+	{
+		snprintf(line.data(), line.size(), "%-*s", name_width, op.name);
+		text += line.data();
+		for (int i = 0; i < BUCKETS; ++i)
+		{
+			if (!op.histogram[i]) continue;
+			snprintf(line.data(), line.size(), "  %s: %llu", bucket_label(i).c_str(), (unsigned long long)op.histogram[i]);
+			text += line.data();
+		}
+		text += "\n";
+	}
+
+	if (dropped)
+	{
+		snprintf(line.data(), line.size(), "\n%llu calls were counted but left out of the trace\n", (unsigned long long)dropped);
+		text += line.data();
+	}
+
+	return text;
+}
+
+#else
+
+void profile_set_enabled(bool)
+{
+}
+
+bool profile_enabled()
+{
+	return false;
+}
+
+void profile_reset()
+{
+}
+
+bool profile_write_trace(const char*)
+{
+	return false;
+}
+
+std::string profile_summary()
+{
+	return "Profiling is not compiled in (build with IMAGE_PROCESSOR_PROFILE=ON)\n";
+}
+
+#endif
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Optional timers around every Image operation, read, write and pipeline run.
+// Each call records its wall time, the pixels it processed, the pixel memory
+// it allocated on the calling thread and the thread it ran on. Calls are kept
+// as events for a Chrome / Perfetto trace, and folded into per-operation
+// totals and time histograms for a summary table.
+//
+// Timers are only compiled in when IP_PROFILE is defined to 1 (CMake option
+// IMAGE_PROCESSOR_PROFILE). Otherwise the IP_PROFILE_* macros expand to
+// nothing, and the functions below record nothing, so the instrumentation
+// can stay in production builds. When compiled in, recording still has to be
+// switched on with profile_set_enabled, and costs one flag check until then.
+
+#ifndef IP_PROFILE
+#define IP_PROFILE 0
+#endif
+
+// Starts or stops recording. Off by default
+void profile_set_enabled(bool enabled);
+bool profile_enabled();
+
+// Discards every event and total recorded so far
+void profile_reset();
+
+// Writes the recorded events as Chrome trace-event JSON, which chrome://tracing
+// and ui.perfetto.dev open. Returns false if the file cannot be written.
+bool profile_write_trace(const char* filename);
+
+// Table of calls, total, mean, min and max time, throughput and allocated
+// bytes per operation, followed by each operation's time histogram
+std::string profile_summary();
+
+#if IP_PROFILE
+
+// Counts pixel memory allocated by the calling thread, for the open timers
+void profile_count_allocation(size_t size);
+
+// Copy of a name built at run time that lives as long as the profile, for
+// timers whose name is not a literal
+const char* profile_intern(const std::string& name);
+
+// Times the enclosing scope as one call of the operation `name`, which must be
+// a string literal or interned. A null name records nothing.
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name, uint64_t pixels);
+	~ProfileScope();
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	// For operations that only learn their size as they go, such as reads
+	inline void set_pixels(uint64_t count) { pixels = count; }
+
+private:
+	const char* name; // nullptr when recording was off at the start
+	uint64_t pixels;
+	uint64_t start;
+	uint64_t allocated;
+};
+
+#define IP_PROFILE_SCOPE(name, pixels) ProfileScope profile_scope(name, pixels)
+// The name expression is only evaluated while recording
+#define IP_PROFILE_SCOPE_NAMED(name, pixels) ProfileScope profile_scope(profile_enabled() ? profile_intern(name) : nullptr, pixels)
+#define IP_PROFILE_PIXELS(pixels) profile_scope.set_pixels(pixels)
+#define IP_PROFILE_ALLOCATION(size) profile_count_allocation(size)
+
+#else
+
+#define IP_PROFILE_SCOPE(name, pixels) ((void)0)
+#define IP_PROFILE_SCOPE_NAMED(name, pixels) ((void)0)
+#define IP_PROFILE_PIXELS(pixels) ((void)0)
+#define IP_PROFILE_ALLOCATION(size) ((void)0)
+
+#endif
@@ -0,0 +1,755 @@
+#include "Resample.h"
+#include "Scratch.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+
+// Weights are 2.14 fixed point, so a 16-bit weight times an 8-bit sample and
+// the sum over a few dozen taps still fit in 32 bits
+static const int RESAMPLE_SHIFT = 14;
+
+static double filter_support(ResizeFilter filter)
+{
+	switch (filter)
+	{
+	case BILINEAR:
+		return 1;
+	case BICUBIC:
+		return 2;
+	case LANCZOS3:
+		return 3;
+	default:
+		return 0.5;
+	}
+}
+
+static double sinc(double x)
+{
+	if (x == 0) return 1;
+	x *= 3.14159265358979323846;
+	return sin(x) / x;
+}
+
+static double filter_weight(ResizeFilter filter, double x)
+{
+	x = fabs(x);
+
+	switch (filter)
+	{
+	case BILINEAR:
+		return x < 1 ? 1 - x : 0;
+	case BICUBIC:
+	{
+		// Catmull-Rom spline, which keeps edges sharp without much ringing
+		const double a = -0.5;
+		if (x < 1) return ((a + 2) * x - (a + 3)) * x * x + 1;
+		if (x < 2) return ((a * x - 5 * a) * x + 8 * a) * x - 4 * a;
+		return 0;
+	}
+	case LANCZOS3:
+		return x < 3 ? sinc(x) * sinc(x / 3) : 0;
+	default:
+		return x < 0.5 ? 1 : 0;
+	}
+}
+
+Contributions make_contributions(int src_size, int dst_size, ResizeFilter filter)
+{
+	Contributions contributions;
+	double ratio = (double)src_size / dst_size;
+	double stretch = std::max(1.0, ratio);
+	double support = filter_support(filter) * stretch;
+
+	int taps = std::max(1, std::min(src_size, (int)ceil(support) * 2 + 1));
+	contributions.taps = taps;
+	contributions.first.resize(dst_size);
+	contributions.weights.assign((size_t)dst_size * taps, 0);
+
+	std::vector<double> window(taps);
+
+	for (int i = 0; i < dst_size; ++i)
+	{
+		// Window of source pixels under the filter, cut off at the image borders
+		double center = (i + 0.5) * ratio;
+		int lo = std::max(0, (int)floor(center - support + 0.5));
+		int hi = std::min(src_size, (int)floor(center + support + 0.5));
+		hi = std::min(hi, lo + taps);
+
+		double total = 0;
+		for (int j = lo; j < hi; ++j)
+		{
+			window[j - lo] = filter_weight(filter, (j + 0.5 - center) / stretch);
+			total += window[j - lo];
+		}
+
+		if (total == 0)
+		{
+			// Only possible for windows cut to nothing at the border
+			lo = std::min(src_size - 1, std::max(0, (int)center));
+			hi = lo + 1;
+			window[0] = total = 1;
+		}
+
+		// Windows near the far border start earlier so every output has `taps` weights
+		int first = std::min(lo, src_size - taps);
+		int16_t* weights = &contributions.weights[(size_t)i * taps];
+		int sum = 0;
+		int largest = lo - first;
+
+		for (int j = lo; j < hi; ++j)
+		{
+			int k = j - first;
+			weights[k] = (int16_t)lround(window[j - lo] / total * (1 << RESAMPLE_SHIFT));
+			sum += weights[k];
+			if (abs(weights[k]) > abs(weights[largest]))
+				largest = k;
+		}
+
+		// Weights must sum to exactly one so flat areas are left unchanged
+		weights[largest] += (1 << RESAMPLE_SHIFT) - sum;
+		contributions.first[i] = first;
+	}
+
+	return contributions;
+}
+
+static inline uint8_t clamp_sample(int32_t acc)
+{
+	acc >>= RESAMPLE_SHIFT;
+	return (uint8_t)(acc < 0 ? 0 : (acc > 255 ? 255 : acc));
+}
+
+// Horizontal pass over the output pixels [begin, dst_width) of one row of C-channel pixels
+template <int C>
+static void resample_row_scalar(const uint8_t* src, uint8_t* dst, int begin, int dst_width, const Contributions& contributions)
+{
+	int taps = contributions.taps;
+
+	for (int x = begin; x < dst_width; ++x)
+	{
+		const uint8_t* in = src + (size_t)contributions.first[x] * C;
+		const int16_t* weights = &contributions.weights[(size_t)x * taps];
+
+		int32_t acc[C];
+		for (int channel = 0; channel < C; ++channel)
+		{
+			acc[channel] = 1 << (RESAMPLE_SHIFT - 1);
+		}
+
+		for (int t = 0; t < taps; ++t)
+		{
+			for (int channel = 0; channel < C; ++channel)
+			{
+				acc[channel] += weights[t] * in[t * C + channel];
+			}
+		}
+
+		for (int channel = 0; channel < C; ++channel)
+		{
+			dst[(size_t)x * C + channel] = clamp_sample(acc[channel]);
+		}
+	}
+}
+
+#if IP_X86
+// RGB and RGBA rows, two taps at a time: the channels of two neighbouring
+// pixels are interleaved so madd applies both weights in one instruction.
+// Returns the number of output pixels written.
+template <int C>
+IP_TARGET_SSE41 static int resample_row_sse41(const uint8_t* src, size_t src_bytes, uint8_t* dst, int dst_width, const Contributions& contributions)
+{
+	const __m128i interleave = C == 4
+		? _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1)
+		: _mm_setr_epi8(0, 3, 1, 4, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	int taps = contributions.taps;
+
+	int x = 0;
+	for (; x < dst_width; ++x)
+	{
+		size_t offset = (size_t)contributions.first[x] * C;
+
+		// RGB pairs are loaded as 8 bytes, which must not run past the row
+		if (C == 3 && offset + (taps - 1) * C + 8 > src_bytes)
+			break;
+
+		const uint8_t* in = src + offset;
+		const int16_t* weights = &contributions.weights[(size_t)x * taps];
+		__m128i acc = _mm_set1_epi32(1 << (RESAMPLE_SHIFT - 1));
+
+		int t = 0;
+		for (; t + 1 < taps; t += 2)
+		{
+			__m128i pair = _mm_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)(in + t * C)), interleave));
+			__m128i w = _mm_set1_epi32((int32_t)(((uint32_t)(uint16_t)weights[t + 1] << 16) | (uint16_t)weights[t]));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(pair, w));
+		}
+		if (t < taps)
+		{
+			uint32_t last = 0;
+			memcpy(&last, in + t * C, C);
+			__m128i pixel = _mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)last));
+			acc = _mm_add_epi32(acc, _mm_mullo_epi32(pixel, _mm_set1_epi32(weights[t])));
+		}
+
+		__m128i words = _mm_packs_epi32(_mm_srai_epi32(acc, RESAMPLE_SHIFT), _mm_setzero_si128());
+		uint32_t bytes = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+		memcpy(dst + (size_t)x * C, &bytes, C);
+	}
+
+	return x;
+}
+#endif
+
+template <int C>
+static void resample_row(const uint8_t* src, uint8_t* dst, int src_width, int dst_width, const Contributions& contributions)
+{
+	int done = 0;
+
+#if IP_X86
+	if ((C == 3 || C == 4) && simd_level() >= SIMD_SSE41)
+		done = resample_row_sse41<C>(src, (size_t)src_width * C, dst, dst_width, contributions);
+#endif
+
+	resample_row_scalar<C>(src, dst, done, dst_width, contributions);
+}
+
+static void resample_row(const uint8_t* src, uint8_t* dst, int src_width, int dst_width, int channels, const Contributions& contributions)
+{
+	switch (channels)
+	{
+	case 1:
+		resample_row<1>(src, dst, src_width, dst_width, contributions);
+		break;
+	case 2:
+		resample_row<2>(src, dst, src_width, dst_width, contributions);
+		break;
+	case 3:
+		resample_row<3>(src, dst, src_width, dst_width, contributions);
+		break;
+	default:
+		resample_row<4>(src, dst, src_width, dst_width, contributions);
+		break;
+	}
+}
+
+// Vertical pass: dst[i] = sum of weights[t] * rows[t][i]
+static void resample_column_scalar(const uint8_t* const* rows, const int16_t* weights, int taps, uint8_t* dst, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; ++i)
+	{
+		int32_t acc = 1 << (RESAMPLE_SHIFT - 1);
+		for (int t = 0; t < taps; ++t)
+		{
+			acc += weights[t] * rows[t][i];
+		}
+		dst[i] = clamp_sample(acc);
+	}
+}
+
+#if IP_X86
+IP_TARGET_SSE41 static size_t resample_column_sse41(const uint8_t* const* rows, const int16_t* weights, int taps, uint8_t* dst, size_t count)
+{
+	__m128i zero = _mm_setzero_si128();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i lo = _mm_set1_epi32(1 << (RESAMPLE_SHIFT - 1));
+		__m128i hi = lo;
+
+		int t = 0;
+		for (; t + 1 < taps; t += 2)
+		{
+			__m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(rows[t] + i)));
+			__m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(rows[t + 1] + i)));
+			__m128i w = _mm_set1_epi32((int32_t)(((uint32_t)(uint16_t)weights[t + 1] << 16) | (uint16_t)weights[t]));
+
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+		}
+		if (t < taps)
+		{
+			__m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(rows[t] + i)));
+			__m128i w = _mm_set1_epi32((uint16_t)weights[t]);
+
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), w));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), w));
+		}
+
+		__m128i words = _mm_packs_epi32(_mm_srai_epi32(lo, RESAMPLE_SHIFT), _mm_srai_epi32(hi, RESAMPLE_SHIFT));
+		_mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(words, words));
+	}
+
+	return i;
+}
+
+IP_TARGET_AVX2 static size_t resample_column_avx2(const uint8_t* const* rows, const int16_t* weights, int taps, uint8_t* dst, size_t count)
+{
+	__m256i zero = _mm256_setzero_si256();
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i lo = _mm256_set1_epi32(1 << (RESAMPLE_SHIFT - 1));
+		__m256i hi = lo;
+
+		// Samples of two rows are interleaved so madd applies a pair of taps at once
+		int t = 0;
+		for (; t + 1 < taps; t += 2)
+		{
+			__m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(rows[t] + i)));
+			__m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(rows[t + 1] + i)));
+			__m256i w = _mm256_set1_epi32((int32_t)(((uint32_t)(uint16_t)weights[t + 1] << 16) | (uint16_t)weights[t]));
+
+			lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+			hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+		}
+		if (t < taps)
+		{
+			__m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(rows[t] + i)));
+			__m256i w = _mm256_set1_epi32((uint16_t)weights[t]);
+
+			lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, zero), w));
+			hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, zero), w));
+		}
+
+		// unpack and pack both work within 128-bit lanes, so this restores byte order
+		__m256i words = _mm256_packs_epi32(_mm256_srai_epi32(lo, RESAMPLE_SHIFT), _mm256_srai_epi32(hi, RESAMPLE_SHIFT));
+		__m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+		_mm_storeu_si128((__m128i*)(dst + i), bytes);
+	}
+
+	return i;
+}
+#endif
+
+static void resample_column(const uint8_t* const* rows, const int16_t* weights, int taps, uint8_t* dst, size_t count)
+{
+	size_t done = 0;
+
+#if IP_X86
+	switch (simd_level())
+	{
+	case SIMD_AVX2:
+		done = resample_column_avx2(rows, weights, taps, dst, count);
+		break;
+	case SIMD_SSE41:
+		done = resample_column_sse41(rows, weights, taps, dst, count);
+		break;
+	default:
+		break;
+	}
+#endif
+
+	resample_column_scalar(rows, weights, taps, dst, done, count);
+}
+
+template <int C>
+static void nearest_row(const uint8_t* src, uint8_t* dst, const int* columns, int dst_width)
+{
+	for (int x = 0; x < dst_width; ++x)
+	{
+		memcpy(dst + (size_t)x * C, src + columns[x], C);
+	}
+}
+
+// Nearest neighbour sampling with the source position of every column and row looked up once
+static void resample_nearest(const ImageView& src, const ImageView& dst)
+{
+	int channels = src.channels;
+	double x_ratio = src.width / (double)dst.width;
+	double y_ratio = src.height / (double)dst.height;
+
+	std::vector<int> columns(dst.width);
+	for (int x = 0; x < dst.width; ++x)
+	{
+		columns[x] = (int)(x * x_ratio) * channels;
+	}
+
+	parallel_rows(dst.height, (size_t)dst.width * channels, [&](int y_begin, int y_end)
+	{
+		for (int y = y_begin; y < y_end; ++y)
+		{
+			const uint8_t* in = src.row((int)(y * y_ratio));
+			uint8_t* out = dst.row(y);
+
+			switch (channels)
+			{
+			case 1:
+				nearest_row<1>(in, out, columns.data(), dst.width);
+				break;
+			case 2:
+				nearest_row<2>(in, out, columns.data(), dst.width);
+				break;
+			case 3:
+				nearest_row<3>(in, out, columns.data(), dst.width);
+				break;
+			default:
+				nearest_row<4>(in, out, columns.data(), dst.width);
+				break;
+			}
+		}
+	});
+}
+
+// Integer factor of a reduction from src_size to dst_size, or 0 if there is none
+static int reduction_factor(int src_size, int dst_size)
+{
+	if (dst_size <= 0 || src_size < dst_size) return 0;
+
+	int factor = src_size / dst_size;
+	return src_size / factor == dst_size ? factor : 0;
+}
+
+static inline bool is_power_of_two(int x)
+{
+	return (x & (x - 1)) == 0;
+}
+
+// Any factors: block sums in 32 bits, one output row of C-channel pixels at a time
+template <int C>
+static void area_downscale_row_scalar(const ImageView& src, uint8_t* out, int y, int fx, int fy, int out_width, const BoxDivider& divide, int begin)
+{
+	int block = fx * fy;
+
+	for (int x = begin; x < out_width; ++x)
+	{
+		uint32_t sums[C] = {};
+
+		for (int i = 0; i < fy; ++i)
+		{
+			const uint8_t* in = src.row(y * fy + i) + (size_t)x * fx * C;
+			for (int j = 0; j < fx; ++j)
+			{
+				for (int channel = 0; channel < C; ++channel)
+				{
+					sums[channel] += in[j * C + channel];
+				}
+			}
+		}
+
+		for (int channel = 0; channel < C; ++channel)
+		{
+			out[(size_t)x * C + channel] = block < 65536 ? divide(sums[channel]) : (uint8_t)((sums[channel] + block / 2) / block);
+		}
+	}
+}
+
+static void area_downscale_row_scalar(const ImageView& src, uint8_t* out, int y, int fx, int fy, int out_width, const BoxDivider& divide, int begin)
+{
+	switch (src.channels)
+	{
+	case 1:
+		area_downscale_row_scalar<1>(src, out, y, fx, fy, out_width, divide, begin);
+		break;
+	case 2:
+		area_downscale_row_scalar<2>(src, out, y, fx, fy, out_width, divide, begin);
+		break;
+	case 3:
+		area_downscale_row_scalar<3>(src, out, y, fx, fy, out_width, divide, begin);
+		break;
+	default:
+		area_downscale_row_scalar<4>(src, out, y, fx, fy, out_width, divide, begin);
+		break;
+	}
+}
+
+// Adds the fx pixels of each block in a row of 16-bit column sums, in place,
+// starting from output pixel `begin`
+template <int C>
+static void sum_blocks(uint16_t* acc, int begin, int out_width, int fx)
+{
+	for (int x = begin; x < out_width; ++x)
+	{
+		const uint16_t* in = acc + (size_t)x * fx * C;
+
+		uint32_t sums[C] = {};
+		for (int j = 0; j < fx; ++j)
+		{
+			for (int channel = 0; channel < C; ++channel)
+			{
+				sums[channel] += in[j * C + channel];
+			}
+		}
+
+		for (int channel = 0; channel < C; ++channel)
+		{
+			acc[(size_t)x * C + channel] = (uint16_t)sums[channel];
+		}
+	}
+}
+
+#if IP_X86
+// Blocks of up to 128 pixels: the fy source rows are summed in 16 bits, then
+// the fx pixels of each block. For 1 and 4 channels and power of two fx,
+// neighbouring pixels are added pairwise with SIMD until one sum per block is
+// left, and for power of two blocks the rounded mean is a shift.
+IP_TARGET_SSE41 static void area_downscale_row_sse41(const ImageView& src, uint8_t* out, int y, int fx, int fy, int out_width, const BoxDivider& divide, uint16_t* acc)
+{
+	int channels = src.channels;
+	size_t count = (size_t)out_width * fx * channels;
+
+	// Sum the fy source rows of each column
+	for (int i = 0; i < fy; ++i)
+	{
+		const uint8_t* in = src.row(y * fy + i);
+		size_t k = 0;
+		for (; k + 16 <= count; k += 16)
+		{
+			__m128i bytes = _mm_loadu_si128((const __m128i*)(in + k));
+			__m128i lo = _mm_cvtepu8_epi16(bytes);
+			__m128i hi = _mm_cvtepu8_epi16(_mm_srli_si128(bytes, 8));
+			if (i > 0)
+			{
+				lo = _mm_add_epi16(lo, _mm_loadu_si128((const __m128i*)(acc + k)));
+				hi = _mm_add_epi16(hi, _mm_loadu_si128((const __m128i*)(acc + k + 8)));
+			}
+			_mm_storeu_si128((__m128i*)(acc + k), lo);
+			_mm_storeu_si128((__m128i*)(acc + k + 8), hi);
+		}
+		for (; k < count; ++k)
+		{
+			acc[k] = (uint16_t)((i > 0 ? acc[k] : 0) + in[k]);
+		}
+	}
+
+	if ((channels == 1 || channels == 4) && is_power_of_two(fx))
+	{
+		// Add neighbouring pixels in place, halving the row each time
+		for (int width = fx; width > 1; width /= 2)
+		{
+			size_t half = count / 2;
+			size_t k = 0;
+			for (; k + 8 <= half; k += 8)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i*)(acc + 2 * k));
+				__m128i b = _mm_loadu_si128((const __m128i*)(acc + 2 * k + 8));
+				__m128i sums = channels == 1
+					? _mm_hadd_epi16(a, b)
+					: _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+				_mm_storeu_si128((__m128i*)(acc + k), sums);
+			}
+			if (channels == 1)
+				sum_blocks<1>(acc, (int)k, (int)half, 2);
+			else
+				sum_blocks<4>(acc, (int)(k / 4), (int)(half / 4), 2);
+			count = half;
+		}
+	}
+	else
+	{
+		switch (channels)
+		{
+		case 1:
+			sum_blocks<1>(acc, 0, out_width, fx);
+			break;
+		case 2:
+			sum_blocks<2>(acc, 0, out_width, fx);
+			break;
+		case 3:
+			sum_blocks<3>(acc, 0, out_width, fx);
+			break;
+		default:
+			sum_blocks<4>(acc, 0, out_width, fx);
+			break;
+		}
+		count = (size_t)out_width * channels;
+	}
+
+	size_t k = 0;
+	if (is_power_of_two(fx * fy))
+	{
+		int shift = 0;
+		while ((1 << shift) < fx * fy) ++shift;
+		__m128i round = _mm_set1_epi16((short)((1 << shift) >> 1));
+
+		for (; k + 16 <= count; k += 16)
+		{
+			__m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(acc + k)), round), shift);
+			__m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(acc + k + 8)), round), shift);
+			_mm_storeu_si128((__m128i*)(out + k), _mm_packus_epi16(lo, hi));
+		}
+	}
+	for (; k < count; ++k)
+	{
+		out[k] = divide(acc[k]);
+	}
+}
+#endif
+
+bool area_downscale(const ImageView& src, const ImageView& dst)
+{
+	int fx = reduction_factor(src.width, dst.width);
+	int fy = reduction_factor(src.height, dst.height);
+	if (!fx || !fy || src.channels != dst.channels) return false;
+
+	int channels = src.channels;
+	BoxDivider divide(std::min(fx * fy, 65535));
+
+	// Sums of up to 128 pixels fit in 16 bits, with room for the rounding term
+	bool fast = fx * fy <= 128;
+
+	parallel_rows(dst.height, (size_t)src.width * channels * fy, [&](int y_begin, int y_end)
+	{
+		ScratchFrame frame;
+		uint16_t* acc = nullptr;
+
+		for (int y = y_begin; y < y_end; ++y)
+		{
+			int done = 0;
+
+#if IP_X86
+			if (fast && simd_level() >= SIMD_SSE41)
+			{
+				if (!acc)
+					acc = frame.alloc<uint16_t>((size_t)dst.width * fx * channels);
+				area_downscale_row_sse41(src, dst.row(y), y, fx, fy, dst.width, divide, acc);
+				done = dst.width;
+			}
+#endif
+
+			area_downscale_row_scalar(src, dst.row(y), y, fx, fy, dst.width, divide, done);
+		}
+	});
+
+	return true;
+}
+
+// Rounded mean of the w x h block of src at (x, y), per channel
+static void block_mean(const ImageView& src, int x, int y, int w, int h, uint8_t* out)
+{
+	int channels = src.channels;
+	uint32_t sums[4] = { 0, 0, 0, 0 };
+
+	for (int i = 0; i < h; ++i)
+	{
+		const uint8_t* in = src.row(y + i) + (size_t)x * channels;
+		for (int j = 0; j < w; ++j)
+		{
+			for (int channel = 0; channel < channels; ++channel)
+			{
+				sums[channel] += in[j * channels + channel];
+			}
+		}
+	}
+
+	uint32_t count = (uint32_t)w * h;
+	for (int channel = 0; channel < channels; ++channel)
+	{
+		out[channel] = (uint8_t)((sums[channel] + count / 2) / count);
+	}
+}
+
+void block_downscale(const ImageView& src, const ImageView& dst, int scale)
+{
+	int whole_w = src.width / scale;
+	int whole_h = src.height / scale;
+	if (whole_w > 0 && whole_h > 0)
+		area_downscale(src.crop(0, 0, whole_w * scale, whole_h * scale), dst.crop(0, 0, whole_w, whole_h));
+
+	// The right column and bottom row of blocks, when the size is not a multiple of scale
+	for (int y = 0; y < dst.height; ++y)
+	{
+		int h = std::min(scale, src.height - y * scale);
+		for (int x = y < whole_h ? whole_w : 0; x < dst.width; ++x)
+		{
+			int w = std::min(scale, src.width - x * scale);
+			block_mean(src, x * scale, y * scale, w, h, dst.row(y) + (size_t)x * dst.channels);
+		}
+	}
+}
+
+void resample(const ImageView& src, const ImageView& dst, ResizeFilter filter)
+{
+	if (src.width <= 0 || src.height <= 0 || dst.width <= 0 || dst.height <= 0) return;
+
+	if (filter == NEAREST)
+	{
+		// Exact reductions average every source pixel at no extra cost
+		if (!(src.width == dst.width && src.height == dst.height) && area_downscale(src, dst))
+			return;
+
+		resample_nearest(src, dst);
+		return;
+	}
+
+	int channels = src.channels;
+	bool horizontal = src.width != dst.width;
+	bool vertical = src.height != dst.height;
+
+	Contributions columns = make_contributions(src.width, dst.width, filter);
+	Contributions rows = make_contributions(src.height, dst.height, filter);
+
+	// Apply filter along X axis for the rows [row_begin, row_end)
+	auto filter_rows = [&](const ImageView& in, const ImageView& out, int row_begin, int row_end)
+	{
+		parallel_rows(row_end - row_begin, (size_t)in.width * channels, [&](int y_begin, int y_end)
+		{
+			for (int y = row_begin + y_begin; y < row_begin + y_end; ++y)
+			{
+				resample_row(in.row(y), out.row(y), in.width, out.width, channels, columns);
+			}
+		});
+	};
+
+	// Apply filter along Y axis, through a table of the rows under each output row
+	auto filter_columns = [&](const ImageView& in, const ImageView& out)
+	{
+		size_t row_bytes = (size_t)out.width * channels;
+		parallel_rows(out.height, row_bytes, [&](int y_begin, int y_end)
+		{
+			std::vector<const uint8_t*> taps(rows.taps);
+
+			for (int y = y_begin; y < y_end; ++y)
+			{
+				for (int t = 0; t < rows.taps; ++t)
+				{
+					taps[t] = in.row(rows.first[y] + t);
+				}
+
+				resample_column(taps.data(), &rows.weights[(size_t)y * rows.taps], rows.taps, out.row(y), row_bytes);
+			}
+		});
+	};
+
+	if (horizontal && vertical)
+	{
+		// Shrinking vertically first leaves the scalar horizontal pass fewer rows,
+		// otherwise only the source rows the vertical pass reads are widened
+		ScratchFrame frame;
+		if (dst.height < src.height)
+		{
+			uint8_t* temp = frame.alloc<uint8_t>((size_t)src.width * channels * dst.height);
+			ImageView shrunk(temp, src.width, dst.height, channels, (ptrdiff_t)src.width * channels);
+			filter_columns(src, shrunk);
+			filter_rows(shrunk, dst, 0, dst.height);
+		}
+		else
+		{
+			uint8_t* temp = frame.alloc<uint8_t>((size_t)dst.width * channels * src.height);
+			ImageView widened(temp, dst.width, src.height, channels, (ptrdiff_t)dst.width * channels);
+			filter_rows(src, widened, rows.first.front(), rows.first.back() + rows.taps);
+			filter_columns(widened, dst);
+		}
+	}
+	else if (horizontal)
+	{
+		filter_rows(src, dst, 0, dst.height);
+	}
+	else if (vertical)
+	{
+		filter_columns(src, dst);
+	}
+	else
+	{
+		for (int y = 0; y < dst.height; ++y)
+		{
+			memcpy(dst.row(y), src.row(y), (size_t)dst.width * channels);
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "Image.h"
+
+// Rounded division by a box size without a divide per pixel. Exact for sizes
+// below 65536, since sums of 8-bit samples never exceed 255 * size.
+struct BoxDivider
+{
+	uint64_t inverse;
+	uint32_t half;
+
+	explicit BoxDivider(int w) : inverse(((1ull << 40) + w - 1) / w), half(w / 2) {}
+	inline uint8_t operator()(uint32_t sum) const { return (uint8_t)(((sum + half) * inverse) >> 40); }
+};
+
+// Source pixels contributing to each output pixel along one axis. Output i
+// reads source pixels first[i] .. first[i] + taps - 1 with the weights
+// weights[i * taps ..], in 2.14 fixed point and summing to exactly 1 << 14.
+struct Contributions
+{
+	int taps = 0;
+	std::vector<int> first;
+	std::vector<int16_t> weights;
+};
+
+// Weights of `filter` for resampling src_size pixels to dst_size. When
+// shrinking, the filter is widened by the scale factor so every source pixel
+// contributes and the result does not alias.
+Contributions make_contributions(int src_size, int dst_size, ResizeFilter filter);
+
+// Averages blocks of src into dst when dst is an integer reduction of src:
+// each output pixel is the rounded mean of an fx x fy block, where
+// fx = src.width / dst.width and fy = src.height / dst.height, and up to
+// fx - 1 columns and fy - 1 rows left over at the right and bottom are
+// ignored. Returns false, leaving dst untouched, for any other sizes.
+bool area_downscale(const ImageView& src, const ImageView& dst);
+
+// Averages scale x scale blocks of src into dst, which must be
+// ceil(src.width / scale) x ceil(src.height / scale). Blocks at the right and
+// bottom edges that run past src average only the pixels they cover.
+void block_downscale(const ImageView& src, const ImageView& dst, int scale);
+
+// Resamples src into dst, which must not overlap and have the same number of channels
+void resample(const ImageView& src, const ImageView& dst, ResizeFilter filter);
@@ -0,0 +1,266 @@
+#include "Rotate.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+
+// Pixels per side of a block transposed in registers, and of a cache tile
+static const int BLOCK = 8;
+static const int TILE = 64;
+
+// Where each source pixel lands: src(x, y) goes to origin + x * x_step + y * y_step
+struct Turn
+{
+	uint8_t* origin;
+	ptrdiff_t x_step;
+	ptrdiff_t y_step;
+
+	inline uint8_t* at(int x, int y) const { return origin + x * x_step + y * y_step; }
+};
+
+// Copies pixel j of each input row i to pixel i of output row j, for an 8x8 block
+template <int C>
+static void transpose_block_scalar(const uint8_t* const* in, uint8_t* const* out)
+{
+	for (int i = 0; i < BLOCK; ++i)
+	{
+		for (int j = 0; j < BLOCK; ++j)
+		{
+			memcpy(out[j] + i * C, in[i] + j * C, C);
+		}
+	}
+}
+
+#if IP_X86
+
+IP_TARGET_SSE41 static inline void transpose_4x4_epi32(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+{
+	__m128i t0 = _mm_unpacklo_epi32(a, b);
+	__m128i t1 = _mm_unpacklo_epi32(c, d);
+	__m128i t2 = _mm_unpackhi_epi32(a, b);
+	__m128i t3 = _mm_unpackhi_epi32(c, d);
+	a = _mm_unpacklo_epi64(t0, t1);
+	b = _mm_unpackhi_epi64(t0, t1);
+	c = _mm_unpacklo_epi64(t2, t3);
+	d = _mm_unpackhi_epi64(t2, t3);
+}
+
+// 8x8 blocks of 4-byte pixels, held as a left and right half of 4 pixels per row
+IP_TARGET_SSE41 static inline void transpose_8x8_epi32(__m128i* lo, __m128i* hi)
+{
+	transpose_4x4_epi32(lo[0], lo[1], lo[2], lo[3]);
+	transpose_4x4_epi32(hi[0], hi[1], hi[2], hi[3]);
+	transpose_4x4_epi32(lo[4], lo[5], lo[6], lo[7]);
+	transpose_4x4_epi32(hi[4], hi[5], hi[6], hi[7]);
+
+	// The top right and bottom left quarters trade places
+	for (int i = 0; i < 4; ++i)
+	{
+		std::swap(hi[i], lo[i + 4]);
+	}
+}
+
+IP_TARGET_SSE41 static void transpose_block_1(const uint8_t* const* in, uint8_t* const* out)
+{
+	__m128i r[BLOCK];
+	for (int i = 0; i < BLOCK; ++i)
+	{
+		r[i] = _mm_loadl_epi64((const __m128i*)in[i]);
+	}
+
+	// Interleave bytes, then pairs, then quads of rows: each result holds two columns
+	__m128i a01 = _mm_unpacklo_epi8(r[0], r[1]);
+	__m128i a23 = _mm_unpacklo_epi8(r[2], r[3]);
+	__m128i a45 = _mm_unpacklo_epi8(r[4], r[5]);
+	__m128i a67 = _mm_unpacklo_epi8(r[6], r[7]);
+	__m128i b0 = _mm_unpacklo_epi16(a01, a23);
+	__m128i b1 = _mm_unpackhi_epi16(a01, a23);
+	__m128i b2 = _mm_unpacklo_epi16(a45, a67);
+	__m128i b3 = _mm_unpackhi_epi16(a45, a67);
+	__m128i columns[4] = { _mm_unpacklo_epi32(b0, b2), _mm_unpackhi_epi32(b0, b2), _mm_unpacklo_epi32(b1, b3), _mm_unpackhi_epi32(b1, b3) };
+
+	for (int j = 0; j < 4; ++j)
+	{
+		_mm_storel_epi64((__m128i*)out[2 * j], columns[j]);
+		_mm_storel_epi64((__m128i*)out[2 * j + 1], _mm_unpackhi_epi64(columns[j], columns[j]));
+	}
+}
+
+IP_TARGET_SSE41 static void transpose_block_2(const uint8_t* const* in, uint8_t* const* out)
+{
+	__m128i t[BLOCK];
+	for (int i = 0; i < BLOCK; i += 2)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)in[i]);
+		__m128i b = _mm_loadu_si128((const __m128i*)in[i + 1]);
+		t[i] = _mm_unpacklo_epi16(a, b);
+		t[i + 1] = _mm_unpackhi_epi16(a, b);
+	}
+
+	// u[k] and u[k + 4] hold columns 2k and 2k + 1 for rows 0-3 and 4-7
+	__m128i u[BLOCK];
+	for (int half = 0; half < 2; ++half)
+	{
+		const __m128i* s = t + half * 4;
+		u[half * 4 + 0] = _mm_unpacklo_epi32(s[0], s[2]);
+		u[half * 4 + 1] = _mm_unpackhi_epi32(s[0], s[2]);
+		u[half * 4 + 2] = _mm_unpacklo_epi32(s[1], s[3]);
+		u[half * 4 + 3] = _mm_unpackhi_epi32(s[1], s[3]);
+	}
+
+	for (int k = 0; k < 4; ++k)
+	{
+		_mm_storeu_si128((__m128i*)out[2 * k], _mm_unpacklo_epi64(u[k], u[k + 4]));
+		_mm_storeu_si128((__m128i*)out[2 * k + 1], _mm_unpackhi_epi64(u[k], u[k + 4]));
+	}
+}
+
+IP_TARGET_SSE41 static void transpose_block_3(const uint8_t* const* in, uint8_t* const* out)
+{
+	// RGB rows are widened to 4 bytes per pixel, transposed and narrowed back
+	const __m128i widen = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i narrow = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	__m128i lo[BLOCK], hi[BLOCK];
+
+	for (int i = 0; i < BLOCK; ++i)
+	{
+		// Rows are 24 bytes: load 16 and 8 so nothing past the row is read
+		__m128i a = _mm_loadu_si128((const __m128i*)in[i]);
+		__m128i b = _mm_loadl_epi64((const __m128i*)(in[i] + 16));
+		lo[i] = _mm_shuffle_epi8(a, widen);
+		hi[i] = _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), widen);
+	}
+
+	transpose_8x8_epi32(lo, hi);
+
+	for (int j = 0; j < BLOCK; ++j)
+	{
+		__m128i first = _mm_shuffle_epi8(lo[j], narrow);
+		__m128i second = _mm_shuffle_epi8(hi[j], narrow);
+		_mm_storeu_si128((__m128i*)out[j], _mm_or_si128(first, _mm_slli_si128(second, 12)));
+		_mm_storel_epi64((__m128i*)(out[j] + 16), _mm_srli_si128(second, 4));
+	}
+}
+
+IP_TARGET_SSE41 static void transpose_block_4(const uint8_t* const* in, uint8_t* const* out)
+{
+	__m128i lo[BLOCK], hi[BLOCK];
+	for (int i = 0; i < BLOCK; ++i)
+	{
+		lo[i] = _mm_loadu_si128((const __m128i*)in[i]);
+		hi[i] = _mm_loadu_si128((const __m128i*)(in[i] + 16));
+	}
+
+	transpose_8x8_epi32(lo, hi);
+
+	for (int j = 0; j < BLOCK; ++j)
+	{
+		_mm_storeu_si128((__m128i*)out[j], lo[j]);
+		_mm_storeu_si128((__m128i*)(out[j] + 16), hi[j]);
+	}
+}
+
+#endif
+
+typedef void (*BlockKernel)(const uint8_t* const* in, uint8_t* const* out);
+
+static BlockKernel block_kernel(int channels)
+{
+#if IP_X86
+	if (simd_level() >= SIMD_SSE41)
+	{
+		static const BlockKernel kernels[4] = { transpose_block_1, transpose_block_2, transpose_block_3, transpose_block_4 };
+		return kernels[channels - 1];
+	}
+#endif
+
+	static const BlockKernel kernels[4] = { transpose_block_scalar<1>, transpose_block_scalar<2>, transpose_block_scalar<3>, transpose_block_scalar<4> };
+	return kernels[channels - 1];
+}
+
+// Moves source rows [y_begin, y_end) to where `turn` sends them, a tile at a time
+static void turn_rows(const ImageView& src, const Turn& turn, BlockKernel kernel, int y_begin, int y_end)
+{
+	int c = src.channels;
+	const uint8_t* in[BLOCK];
+	uint8_t* out[BLOCK];
+
+	for (int x0 = 0; x0 < src.width; x0 += TILE)
+	{
+		int x1 = std::min(src.width, x0 + TILE);
+
+		for (int y = y_begin; y < y_end; y += BLOCK)
+		{
+			int block_rows = std::min(BLOCK, y_end - y);
+			int x = x0;
+
+			if (block_rows == BLOCK)
+			{
+				// Output rows run in increasing y, so feed the rows in the order
+				// they land in: reversed when y_step is negative
+				bool reversed = turn.y_step < 0;
+				for (int i = 0; i < BLOCK; ++i)
+				{
+					in[i] = src.row(reversed ? y + BLOCK - 1 - i : y + i);
+				}
+
+				int first_y = reversed ? y + BLOCK - 1 : y;
+				for (; x + BLOCK <= x1; x += BLOCK)
+				{
+					const uint8_t* block_in[BLOCK];
+					for (int i = 0; i < BLOCK; ++i)
+					{
+						block_in[i] = in[i] + x * c;
+					}
+					for (int j = 0; j < BLOCK; ++j)
+					{
+						out[j] = turn.at(x + j, first_y);
+					}
+					kernel(block_in, out);
+				}
+			}
+
+			// Columns left over at the right of the image, or rows at the bottom of the band
+			for (int yy = y; yy < y + block_rows; ++yy)
+			{
+				const uint8_t* line = src.row(yy);
+				for (int xx = x; xx < x1; ++xx)
+				{
+					memcpy(turn.at(xx, yy), line + xx * c, c);
+				}
+			}
+		}
+	}
+}
+
+static void turn_image(const ImageView& src, const Turn& turn)
+{
+	if (src.channels < 1 || src.channels > 4) return;
+
+	BlockKernel kernel = block_kernel(src.channels);
+	int bands = (src.height + TILE - 1) / TILE;
+	size_t band_bytes = (size_t)TILE * src.width * src.channels;
+
+	// Bands of whole tiles, so blocks never straddle two bands
+	parallel_rows(bands, band_bytes, [&](int band_begin, int band_end)
+	{
+		turn_rows(src, turn, kernel, band_begin * TILE, std::min(src.height, band_end * TILE));
+	});
+}
+
+void transpose(const ImageView& src, const ImageView& dst)
+{
+	turn_image(src, { dst.data, dst.stride, src.channels });
+}
+
+void rotate90(const ImageView& src, const ImageView& dst)
+{
+	// Source row y becomes destination column height - 1 - y
+	turn_image(src, { dst.data + (ptrdiff_t)(src.height - 1) * src.channels, dst.stride, -src.channels });
+}
+
+void rotate270(const ImageView& src, const ImageView& dst)
+{
+	// Source column x becomes destination row width - 1 - x
+	turn_image(src, { dst.data + (ptrdiff_t)(src.width - 1) * dst.stride, -dst.stride, src.channels });
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "Image.h"
+
+// Quarter turns of src into dst, which must be src.height pixels wide and
+// src.width pixels high, have the same number of channels and not overlap
+// src. The image is walked in 64x64 tiles so reads and writes both stay in
+// cache, and each tile is moved in 8x8 blocks that are transposed in SSE
+// registers (1 to 4 channels) when the CPU has SSE4.1. Bands of tiles run on
+// the thread pool.
+
+// Mirrors src along its main diagonal: dst(x, y) = src(y, x)
+void transpose(const ImageView& src, const ImageView& dst);
+
+// Turns src a quarter turn clockwise
+void rotate90(const ImageView& src, const ImageView& dst);
+
+// Turns src a quarter turn counterclockwise
+void rotate270(const ImageView& src, const ImageView& dst);
@@ -0,0 +1,639 @@
+#include "RowPipeline.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#define BYTE_BOUND(x) x < 0 ? 0 : (x > 255 ? 255 : x)
+
+using namespace std;
+
+
+int get_border_values(int M, int x)
+{
+	if (x < 0)
+	{
+		x = -x - 1;
+	}
+	if (x >= M)
+	{
+		// Kernels wider than the image reflect back and forth across it
+		x %= 2 * M;
+		if (x >= M) x = 2 * M - x - 1;
+	}
+
+	return x;
+}
+
+void PointStage::add(Kind kind, const ColorMask& mask)
+{
+	ops.push_back({ kind, mask });
+}
+
+std::string PointStage::name() const
+{
+	static const char* const names[] = { "grayscale_avg", "grayscale_lum", "color_mask" };
+
+	std::string text;
+	for (const Op& op : ops)
+	{
+		if (!text.empty()) text += '+';
+		text += names[op.kind];
+	}
+
+	return text;
+}
+
+void PointStage::process(const uint8_t* const* rows, uint8_t* out, int width, int channels, std::vector<uint8_t>& /* scratch */) const
+{
+	if (out != rows[0])
+	{
+		memcpy(out, rows[0], (size_t)width * channels);
+	}
+
+	// Point operations only apply to color images, like their Image counterparts
+	if (channels < 3) return;
+
+	for (const Op& op : ops)
+	{
+		switch (op.kind)
+		{
+		case GRAYSCALE_AVG:
+			grayscale_avg_row(out, width, channels);
+			break;
+		case GRAYSCALE_LUM:
+			grayscale_lum_row(out, width, channels);
+			break;
+		case COLOR_MASK:
+			color_mask_row(out, width, channels, op.mask);
+			break;
+		}
+	}
+}
+
+// Gaussian kernels are applied with 16-bit fixed point weights and 32-bit
+// accumulators instead of doubles. Rounding matches round() on the double path.
+static const int BLUR_SHIFT = 14;
+
+static std::vector<int16_t> fixed_point_kernel(const std::vector<double>& kernel)
+{
+	std::vector<int16_t> weights(kernel.size());
+	int total = 0;
+
+	for (size_t i = 0; i < kernel.size(); ++i)
+	{
+		weights[i] = (int16_t)lround(kernel[i] * (1 << BLUR_SHIFT));
+		total += weights[i];
+	}
+
+	// Weights must sum to exactly one so flat areas are left unchanged
+	weights[kernel.size() / 2] += (1 << BLUR_SHIFT) - total;
+	return weights;
+}
+
+// dst[i] = sum of weights[t] * taps[t][i], so the same loop serves both axes
+static void apply_fixed_point_kernel(const uint8_t* const* taps, const int16_t* weights, int tap_count, int32_t* acc, uint8_t* dst, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		acc[i] = 1 << (BLUR_SHIFT - 1);
+	}
+
+	for (int t = 0; t < tap_count; ++t)
+	{
+		const uint8_t* tap = taps[t];
+		int32_t weight = weights[t];
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			acc[i] += weight * tap[i];
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		dst[i] = (uint8_t)(acc[i] >> BLUR_SHIFT);
+	}
+}
+
+std::vector<double> gaussian_strength_kernel(int strength)
+{
+	// Coefficients of a 1-dimensional gaussian kernel with sigma = 1
+	switch (strength)
+	{
+	case 1:
+		return { 0.27901,	0.44198, 0.27901 };
+	case 2:
+		return { 0.06136,	0.24477, 0.38774, 0.24477, 0.06136 };
+	case 3:
+		return { 0.00598,	0.060626, 0.241843, 0.383103, 0.241843, 0.060626, 0.00598 };
+	case 4:
+		return { 0.000229, 0.005977, 0.060598, 0.241732, 0.382928, 0.241732, 0.060598, 0.005977, 0.000229 };
+	default:
+		return { 0.27901,	0.44198, 0.27901 };
+	}
+}
+
+BlurStage::BlurStage(const std::vector<double>& kernel)
+	: weights(fixed_point_kernel(kernel)), radius((int)(kernel.size() - 1) / 2)
+{
+}
+
+void BlurStage::process(const uint8_t* const* rows, uint8_t* out, int width, int channels, std::vector<uint8_t>& scratch) const
+{
+	size_t row_bytes = (size_t)width * channels;
+	int N = radius;
+	int kernel_length = 2 * N + 1;
+
+	// Accumulators, then the vertical result padded with its mirrored border pixels
+	scratch.resize(row_bytes * sizeof(int32_t) + (width + 2 * N) * channels);
+	int32_t* acc = reinterpret_cast<int32_t*>(scratch.data());
+	uint8_t* padded = scratch.data() + row_bytes * sizeof(int32_t);
+
+	// Apply blur along Y axis straight into the middle of the padded row
+	uint8_t* line = padded + N * channels;
+	apply_fixed_point_kernel(rows, weights.data(), kernel_length, acc, line, row_bytes);
+
+	for (int i = 1; i <= N; ++i)
+	{
+		memcpy(&padded[(N - i) * channels], line + get_border_values(width, -i) * channels, channels);
+		memcpy(&padded[(N + width - 1 + i) * channels], line + get_border_values(width, width - 1 + i) * channels, channels);
+	}
+
+	// Apply blur along X axis
+	const uint8_t* taps[64];
+	std::vector<const uint8_t*> heap_taps;
+	const uint8_t** tap_table = taps;
+	if (kernel_length > 64)
+	{
+		heap_taps.resize(kernel_length);
+		tap_table = heap_taps.data();
+	}
+	for (int i = 0; i < kernel_length; ++i)
+	{
+		tap_table[i] = &padded[i * channels];
+	}
+
+	apply_fixed_point_kernel(tap_table, weights.data(), kernel_length, acc, out, row_bytes);
+}
+
+void SharpenStage::process(const uint8_t* const* rows, uint8_t* out, int width, int channels, std::vector<uint8_t>& /* scratch */) const
+{
+	static const double kernel[] = { -0.11111, -0.11111, -0.11111, -0.11111, 2, -0.11111, -0.11111, -0.11111, -0.11111 };
+
+	for (int x = 0; x < width; ++x)
+	{
+		for (int channel = 0; channel < channels; ++channel)
+		{
+			double sum = 0;
+
+			for (int i = -1; i <= 1; i++) {
+				const uint8_t* line = rows[i + 1];
+				for (int j = -1; j <= 1; ++j)
+				{
+					int kernel_index = 4 + i * 3 + j;
+					sum += kernel[kernel_index] * line[get_border_values(width, x + j) * channels + channel];
+				}
+			}
+
+			// Blend the sharpened pixel with the original one
+			uint8_t sharpened = BYTE_BOUND(round(sum));
+			size_t index = (size_t)x * channels + channel;
+			out[index] = (sharpened + rows[1][index]) / 2;
+		}
+	}
+}
+
+SobelStage::SobelStage(double cutoff)
+{
+	// round(sqrt(g)) > cutoff exactly when g > k * (k - 1), with k = floor(cutoff) + 1.
+	// Gradients never exceed 1020 along each axis, so their magnitude stays below 1443.
+	if (cutoff < 0)
+		threshold = -1;
+	else if (cutoff >= 2048)
+		threshold = INT32_MAX;
+	else
+	{
+		int32_t k = (int32_t)floor(cutoff) + 1;
+		threshold = k * (k - 1);
+	}
+}
+
+// Vertical half of the Sobel operator: s = top + 2 * middle + bottom smooths
+// for Gx, and d = bottom - top differentiates for Gy
+static void sobel_columns_scalar(const uint8_t* top, const uint8_t* mid, const uint8_t* bot, int16_t* s, int16_t* d, int begin, int end)
+{
+	for (int x = begin; x < end; ++x)
+	{
+		s[x] = (int16_t)(top[x] + 2 * mid[x] + bot[x]);
+		d[x] = (int16_t)(bot[x] - top[x]);
+	}
+}
+
+// Horizontal half: Gx = s[x - 1] - s[x + 1] and Gy = d[x - 1] + 2 * d[x] + d[x + 1],
+// compared squared against the threshold so no square root is needed
+static void sobel_threshold_scalar(const int16_t* s, const int16_t* d, uint8_t* mask, int32_t threshold, int begin, int end)
+{
+	for (int x = begin; x < end; ++x)
+	{
+		int32_t gx = s[x - 1] - s[x + 1];
+		int32_t gy = d[x - 1] + 2 * d[x] + d[x + 1];
+		mask[x] = gx * gx + gy * gy > threshold ? 255 : 0;
+	}
+}
+
+#if IP_X86
+IP_TARGET_AVX2 static int sobel_columns_avx2(const uint8_t* top, const uint8_t* mid, const uint8_t* bot, int16_t* s, int16_t* d, int width)
+{
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i t = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(top + x)));
+		__m256i m = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(mid + x)));
+		__m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(bot + x)));
+
+		_mm256_storeu_si256((__m256i*)(s + x), _mm256_add_epi16(_mm256_add_epi16(t, b), _mm256_slli_epi16(m, 1)));
+		_mm256_storeu_si256((__m256i*)(d + x), _mm256_sub_epi16(b, t));
+	}
+
+	return x;
+}
+
+IP_TARGET_AVX2 static int sobel_threshold_avx2(const int16_t* s, const int16_t* d, uint8_t* mask, int32_t threshold, int width)
+{
+	__m256i limit = _mm256_set1_epi32(threshold);
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i gx = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(s + x - 1)), _mm256_loadu_si256((const __m256i*)(s + x + 1)));
+		__m256i gy = _mm256_add_epi16(
+			_mm256_add_epi16(_mm256_loadu_si256((const __m256i*)(d + x - 1)), _mm256_loadu_si256((const __m256i*)(d + x + 1))),
+			_mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(d + x)), 1));
+
+		// Interleaving Gx with Gy lets madd produce Gx^2 + Gy^2 in 32 bits
+		__m256i lo = _mm256_unpacklo_epi16(gx, gy);
+		__m256i hi = _mm256_unpackhi_epi16(gx, gy);
+		lo = _mm256_cmpgt_epi32(_mm256_madd_epi16(lo, lo), limit);
+		hi = _mm256_cmpgt_epi32(_mm256_madd_epi16(hi, hi), limit);
+
+		// unpack and pack both work within 128-bit lanes, so this restores pixel order
+		__m256i words = _mm256_packs_epi32(lo, hi);
+		__m128i bytes = _mm_packs_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+		_mm_storeu_si128((__m128i*)(mask + x), bytes);
+	}
+
+	return x;
+}
+#endif
+
+void SobelStage::process(const uint8_t* const* rows, uint8_t* out, int width, int channels, std::vector<uint8_t>& scratch) const
+{
+	// Gradients padded with one mirrored column on each side, then the three
+	// gray input rows and the mask when the image has more than one channel
+	size_t padded_bytes = (size_t)(width + 2) * sizeof(int16_t);
+	size_t gray_bytes = channels == 1 ? 0 : (size_t)width * 4;
+	scratch.resize(2 * padded_bytes + gray_bytes);
+
+	int16_t* s = reinterpret_cast<int16_t*>(scratch.data()) + 1;
+	int16_t* d = s + width + 2;
+	uint8_t* gray = scratch.data() + 2 * padded_bytes;
+	uint8_t* mask = channels == 1 ? out : gray + 3 * width;
+
+	const uint8_t* lines[3] = { rows[0], rows[1], rows[2] };
+	if (channels > 1)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			uint8_t* line = gray + i * width;
+			for (int x = 0; x < width; ++x)
+			{
+				line[x] = rows[i][(size_t)x * channels];
+			}
+			lines[i] = line;
+		}
+	}
+
+	int columns_done = 0;
+#if IP_X86
+	if (simd_level() >= SIMD_AVX2)
+		columns_done = sobel_columns_avx2(lines[0], lines[1], lines[2], s, d, width);
+#endif
+	sobel_columns_scalar(lines[0], lines[1], lines[2], s, d, columns_done, width);
+
+	s[-1] = s[get_border_values(width, -1)];
+	d[-1] = d[get_border_values(width, -1)];
+	s[width] = s[get_border_values(width, width)];
+	d[width] = d[get_border_values(width, width)];
+
+	int mask_done = 0;
+#if IP_X86
+	if (simd_level() >= SIMD_AVX2)
+		mask_done = sobel_threshold_avx2(s, d, mask, threshold, width);
+#endif
+	sobel_threshold_scalar(s, d, mask, threshold, mask_done, width);
+
+	if (channels > 1)
+	{
+		int color_channels = channels >= 3 ? 3 : 1;
+		for (int x = 0; x < width; ++x)
+		{
+			uint8_t* px = out + (size_t)x * channels;
+			const uint8_t* src = rows[1] + (size_t)x * channels;
+
+			for (int channel = 0; channel < color_channels; ++channel)
+			{
+				px[channel] = mask[x];
+			}
+			for (int channel = color_channels; channel < channels; ++channel)
+			{
+				px[channel] = src[channel];
+			}
+		}
+	}
+}
+
+RowChain::RowChain(const std::vector<const RowStage*>& stages, int width, int height, int channels, int first_row, int last_row, const RowTarget& target)
+	: target(target), width(width), height(height), channels(channels), row_bytes((size_t)width * channels)
+{
+	int first = first_row;
+	int last = last_row;
+
+	levels.resize(stages.size());
+	for (size_t i = 0; i < stages.size(); ++i)
+	{
+		Level& level = levels[i];
+		level.stage = stages[i];
+		level.halo = stages[i]->halo();
+		level.next_in = first;
+
+		// Rows can be produced where the whole window is available, or mirrored
+		// from available rows at the image borders
+		level.next_out = first == 0 ? 0 : first + level.halo;
+		level.out_last = last == height ? height : last - level.halo;
+		first = level.next_out;
+		last = std::max(level.next_out, level.out_last);
+
+		if (level.halo > 0)
+		{
+			level.capacity = 2 * level.halo + 1;
+			level.ring = frame.alloc<uint8_t>(level.capacity * row_bytes);
+			level.taps.resize(level.capacity);
+		}
+		else
+		{
+			level.capacity = 0;
+			level.ring = nullptr;
+			level.taps.resize(1);
+		}
+
+		level.out = i + 1 < stages.size() ? frame.alloc<uint8_t>(row_bytes) : nullptr;
+	}
+}
+
+void RowChain::output_range(const std::vector<const RowStage*>& stages, int height, int first, int last, int& out_first, int& out_last)
+{
+	for (const RowStage* stage : stages)
+	{
+		int halo = stage->halo();
+		int next_first = first == 0 ? 0 : first + halo;
+		int next_last = last == height ? height : last - halo;
+		first = next_first;
+		last = std::max(next_first, next_last);
+	}
+
+	out_first = first;
+	out_last = last;
+}
+
+void RowChain::push(const uint8_t* row)
+{
+	if (!levels.empty())
+	{
+		feed(0, row);
+	}
+}
+
+void RowChain::feed(size_t index, const uint8_t* row)
+{
+	Level& level = levels[index];
+	bool last = index + 1 == levels.size();
+	int y_in = level.next_in++;
+
+	if (level.halo > 0)
+	{
+		memcpy(&level.ring[(y_in % level.capacity) * row_bytes], row, row_bytes);
+	}
+
+	// Emit every row whose window is now complete
+	while (level.next_out < level.out_last && std::min(height - 1, level.next_out + level.halo) < level.next_in)
+	{
+		int y = level.next_out++;
+
+		if (level.halo > 0)
+		{
+			for (int k = 0; k < level.capacity; ++k)
+			{
+				int source = get_border_values(height, y - level.halo + k);
+				level.taps[k] = &level.ring[(source % level.capacity) * row_bytes];
+			}
+		}
+		else
+		{
+			level.taps[0] = row;
+		}
+
+		if (last)
+		{
+			uint8_t* out = target(y);
+			if (out)
+			{
+				level.stage->process(level.taps.data(), out, width, channels, scratch);
+			}
+		}
+		else
+		{
+			level.stage->process(level.taps.data(), level.out, width, channels, scratch);
+			feed(index + 1, level.out);
+		}
+	}
+}
+
+static int total_halo_of(const std::vector<const RowStage*>& stages)
+{
+	int total_halo = 0;
+	for (const RowStage* stage : stages)
+	{
+		total_halo += stage->halo();
+	}
+
+	return total_halo;
+}
+
+// Height of the bands `rows` rows are split into. Bands recompute
+// 2 * total_halo rows each, so keep them tall enough for that to stay a small
+// fraction of the work
+static int band_height(int rows, int total_halo, size_t row_bytes)
+{
+	int workers = ThreadPool::worker_count();
+	int min_rows = std::max(16 * total_halo, (int)std::max<size_t>(1, (64 * 1024) / row_bytes));
+	int band_count = std::max(1, std::min(workers * 2, rows / min_rows));
+	return (rows + band_count - 1) / band_count;
+}
+
+std::string row_stages_name(const std::vector<const RowStage*>& stages)
+{
+	std::string text;
+	for (const RowStage* stage : stages)
+	{
+		if (!text.empty()) text += '+';
+		text += stage->name();
+	}
+
+	return text;
+}
+
+void run_row_stages(const ImageView& src, const ImageView& dst, const std::vector<const RowStage*>& stages)
+{
+	int width = src.width;
+	int height = src.height;
+	int channels = src.channels;
+	size_t row_bytes = (size_t)width * channels;
+
+	if (height <= 0 || width <= 0) return;
+
+	if (stages.empty())
+	{
+		if (src.data != dst.data)
+		{
+			for (int y = 0; y < height; ++y)
+			{
+				memcpy(dst.row(y), src.row(y), row_bytes);
+			}
+		}
+		return;
+	}
+
+	int total_halo = total_halo_of(stages);
+
+	// Point operations need no neighbours, so every row runs the whole chain in place
+	if (total_halo == 0)
+	{
+		parallel_rows(height, row_bytes, [&](int y_begin, int y_end)
+		{
+			std::vector<uint8_t> scratch;
+			for (int y = y_begin; y < y_end; ++y)
+			{
+				const uint8_t* in = src.row(y);
+				uint8_t* out = dst.row(y);
+				for (const RowStage* stage : stages)
+				{
+					stage->process(&in, out, width, channels, scratch);
+					in = out;
+				}
+			}
+		});
+		return;
+	}
+
+	int band_rows = band_height(height, total_halo, row_bytes);
+	int band_count = (height + band_rows - 1) / band_rows;
+
+	// When filtering in place, a band overwrites rows its neighbours still
+	// need to read, so the rows around each band boundary are copied first
+	bool in_place = src.data == dst.data;
+	ScratchFrame frame;
+	std::vector<uint8_t*> above(band_count);
+	std::vector<uint8_t*> below(band_count);
+	if (in_place && band_count > 1)
+	{
+		for (int band = 0; band < band_count; ++band)
+		{
+			int y0 = band * band_rows;
+			int y1 = std::min(height, y0 + band_rows);
+			int first = std::max(0, y0 - total_halo);
+			int last = std::min(height, y1 + total_halo);
+
+			above[band] = frame.alloc<uint8_t>((y0 - first) * row_bytes);
+			for (int y = first; y < y0; ++y)
+			{
+				memcpy(&above[band][(y - first) * row_bytes], src.row(y), row_bytes);
+			}
+
+			below[band] = frame.alloc<uint8_t>((last - y1) * row_bytes);
+			for (int y = y1; y < last; ++y)
+			{
+				memcpy(&below[band][(y - y1) * row_bytes], src.row(y), row_bytes);
+			}
+		}
+	}
+
+	ThreadPool::instance().parallel_for(band_count, 1, [&](int band_begin, int band_end)
+	{
+		for (int band = band_begin; band < band_end; ++band)
+		{
+			int y0 = band * band_rows;
+			int y1 = std::min(height, y0 + band_rows);
+			int first = std::max(0, y0 - total_halo);
+			int last = std::min(height, y1 + total_halo);
+			bool copied = in_place && band_count > 1;
+
+			RowChain chain(stages, width, height, channels, first, last, [&](int y) -> uint8_t*
+			{
+				return y >= y0 && y < y1 ? dst.row(y) : nullptr;
+			});
+
+			for (int y = first; y < last; ++y)
+			{
+				if (copied && y < y0)
+					chain.push(&above[band][(y - first) * row_bytes]);
+				else if (copied && y >= y1)
+					chain.push(&below[band][(y - y1) * row_bytes]);
+				else
+					chain.push(src.row(y));
+			}
+		}
+	});
+}
+
+void run_row_stages(int width, int height, int channels, int y_begin, int y_end, const RowSource& source, const RowChain::RowTarget& target,
+	const std::vector<const RowStage*>& stages)
+{
+	size_t row_bytes = (size_t)width * channels;
+	int rows = y_end - y_begin;
+	if (rows <= 0 || width <= 0) return;
+
+	int total_halo = total_halo_of(stages);
+	int band_rows = band_height(rows, total_halo, row_bytes);
+	int band_count = (rows + band_rows - 1) / band_rows;
+
+	ThreadPool::instance().parallel_for(band_count, 1, [&](int band_begin, int band_end)
+	{
+		for (int band = band_begin; band < band_end; ++band)
+		{
+			int y0 = y_begin + band * band_rows;
+			int y1 = std::min(y_end, y0 + band_rows);
+			int first = std::max(0, y0 - total_halo);
+			int last = std::min(height, y1 + total_halo);
+
+			if (stages.empty())
+			{
+				for (int y = y0; y < y1; ++y)
+				{
+					memcpy(target(y), source(y), row_bytes);
+				}
+				continue;
+			}
+
+			RowChain chain(stages, width, height, channels, first, last, [&](int y) -> uint8_t*
+			{
+				return y >= y0 && y < y1 ? target(y) : nullptr;
+			});
+
+			for (int y = first; y < last; ++y)
+			{
+				chain.push(source(y));
+			}
+		}
+	});
+}
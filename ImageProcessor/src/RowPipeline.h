@@ -0,0 +1,163 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Image.h"
+#include "PointOps.h"
+#include "Scratch.h"
+
+// Mirrors an out of range coordinate back into [0, M) without repeating the edge
+int get_border_values(int M, int x);
+
+// Coefficients of the 1-dimensional gaussian kernel for gaussian_blur(int strength)
+std::vector<double> gaussian_strength_kernel(int strength);
+
+// One step of a row pipeline. Output row y depends only on input rows
+// y - halo() .. y + halo(), mirrored at the top and bottom of the image, so
+// stages can stream rows through a small rolling window instead of needing
+// the whole frame.
+class RowStage
+{
+public:
+	virtual ~RowStage() = default;
+
+	virtual int halo() const = 0;
+
+	// Name of the operation in profiles, such as "sharpen"
+	virtual std::string name() const = 0;
+
+	// rows[i] is input row y - halo() + i. For stages without halo, out may be
+	// rows[0]. scratch belongs to the caller and may be resized freely.
+	virtual void process(const uint8_t* const* rows, uint8_t* out, int width, int channels, std::vector<uint8_t>& scratch) const = 0;
+};
+
+// Chain of per-pixel operations applied to each row while it is in cache
+class PointStage : public RowStage
+{
+public:
+	enum Kind
+	{
+		GRAYSCALE_AVG, GRAYSCALE_LUM, COLOR_MASK
+	};
+
+	void add(Kind kind, const ColorMask& mask = ColorMask());
+	inline bool empty() const { return ops.empty(); }
+
+	int halo() const override { return 0; }
+	std::string name() const override;
+	void process(const uint8_t* const* rows, uint8_t* out, int width, int channels, std::vector<uint8_t>& scratch) const override;
+
+private:
+	struct Op
+	{
+		Kind kind;
+		ColorMask mask;
+	};
+
+	std::vector<Op> ops;
+};
+
+// Separable convolution with a symmetric kernel in fixed point
+class BlurStage : public RowStage
+{
+public:
+	explicit BlurStage(const std::vector<double>& kernel);
+
+	int halo() const override { return radius; }
+	std::string name() const override { return "gaussian_blur"; }
+	void process(const uint8_t* const* rows, uint8_t* out, int width, int channels, std::vector<uint8_t>& scratch) const override;
+
+private:
+	std::vector<int16_t> weights;
+	int radius;
+};
+
+class SharpenStage : public RowStage
+{
+public:
+	int halo() const override { return 1; }
+	std::string name() const override { return "sharpen"; }
+	void process(const uint8_t* const* rows, uint8_t* out, int width, int channels, std::vector<uint8_t>& scratch) const override;
+};
+
+// Sobel gradient magnitude mapped to black and white at `cutoff`. The input
+// must already be grayscale: only the first channel is filtered, the result is
+// copied to the other color channels and alpha is kept.
+class SobelStage : public RowStage
+{
+public:
+	explicit SobelStage(double cutoff);
+
+	int halo() const override { return 1; }
+	std::string name() const override { return "edge_detection"; }
+	void process(const uint8_t* const* rows, uint8_t* out, int width, int channels, std::vector<uint8_t>& scratch) const override;
+
+private:
+	int32_t threshold; // Pixels with Gx^2 + Gy^2 > threshold become white
+};
+
+// Streams the rows of one image through a chain of stages. Each stage keeps
+// only its last 2 * halo + 1 input rows, so intermediate results never leave
+// the cache. Input rows [first_row, last_row) are pushed in order, and every
+// output row that can be computed from them is written where target() says.
+class RowChain
+{
+public:
+	// Returns where output row y should be written
+	typedef std::function<uint8_t*(int y)> RowTarget;
+
+	RowChain(const std::vector<const RowStage*>& stages, int width, int height, int channels, int first_row, int last_row, const RowTarget& target);
+
+	void push(const uint8_t* row);
+
+	// Output rows produced from input rows [first, last)
+	static void output_range(const std::vector<const RowStage*>& stages, int height, int first, int last, int& out_first, int& out_last);
+
+private:
+	struct Level
+	{
+		const RowStage* stage;
+		int halo;
+		int capacity;
+		int next_in;
+		int next_out;
+		int out_last;
+		uint8_t* ring;
+		uint8_t* out;
+		std::vector<const uint8_t*> taps;
+	};
+
+	void feed(size_t level, const uint8_t* row);
+
+	ScratchFrame frame; // Holds the rings and intermediate rows
+	std::vector<Level> levels;
+	std::vector<uint8_t> scratch;
+	RowTarget target;
+	int width;
+	int height;
+	int channels;
+	size_t row_bytes;
+};
+
+// Names of the stages joined by '+', e.g. "grayscale_lum+sharpen"
+std::string row_stages_name(const std::vector<const RowStage*>& stages);
+
+// Returns input row y of an image being streamed
+typedef std::function<const uint8_t*(int y)> RowSource;
+
+// Runs the stages over every row of src, writing to dst (which may be src).
+// Rows are split into bands processed in parallel. Each band recomputes the
+// halo rows it needs from its neighbours, so the result does not depend on the
+// number of threads.
+void run_row_stages(const ImageView& src, const ImageView& dst, const std::vector<const RowStage*>& stages);
+
+// Computes output rows [y_begin, y_end) of an image `height` rows tall that is
+// not held in memory as a whole. Input rows are read through source and only
+// within the stages' combined halo of the range, so callers need to hold just
+// that strip; output rows are written through target and must not overlap
+// the input. Bands run in parallel as in the function above.
+void run_row_stages(int width, int height, int channels, int y_begin, int y_end, const RowSource& source, const RowChain::RowTarget& target,
+	const std::vector<const RowStage*>& stages);
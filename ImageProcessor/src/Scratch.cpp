@@ -0,0 +1,154 @@
+#include "Scratch.h"
+#include <algorithm>
+#include <atomic>
+
+// Smallest block an arena allocates, so the per-row temporaries of most
+// passes fit in the first one
+static const size_t MIN_BLOCK = 256 * 1024;
+
+static std::atomic<size_t> total_reserved(0);
+static std::atomic<size_t> total_high_water(0);
+
+ScratchArena& ScratchArena::local()
+{
+	static thread_local ScratchArena arena;
+	return arena;
+}
+
+ScratchArena::~ScratchArena()
+{
+	total_reserved -= reserved();
+}
+
+size_t ScratchArena::reserved() const
+{
+	size_t bytes = 0;
+	for (const PixelBuffer& block : blocks)
+	{
+		bytes += block.size();
+	}
+
+	return bytes;
+}
+
+void* ScratchArena::allocate(size_t size)
+{
+	size = (size + PixelBuffer::ALIGNMENT - 1) & ~(PixelBuffer::ALIGNMENT - 1);
+
+	if (blocks.empty() || offset + size > blocks[current].size())
+	{
+		if (current + 1 < blocks.size() && size <= blocks[current + 1].size())
+		{
+			++current;
+		}
+		else
+		{
+			// Blocks past the current one are free, but too small: replace them
+			// with one that also covers everything allocated so far, so once
+			// the frames end the arena can merge into a single block
+			size_t held = reserved();
+			size_t first_free = blocks.empty() ? 0 : current + 1;
+			for (size_t i = first_free; i < blocks.size(); ++i)
+			{
+				held -= blocks[i].size();
+			}
+			total_reserved -= reserved() - held;
+			blocks.resize(first_free);
+
+			size_t block_size = std::max({ size, held, MIN_BLOCK });
+			blocks.emplace_back(block_size);
+			total_reserved += block_size;
+			current = blocks.size() - 1;
+		}
+
+		offset = 0;
+	}
+
+	void* p = blocks[current].data() + offset;
+	offset += size;
+	in_use += size;
+
+	peak = std::max(peak, in_use);
+
+	size_t seen = total_high_water.load(std::memory_order_relaxed);
+	while (in_use > seen && !total_high_water.compare_exchange_weak(seen, in_use, std::memory_order_relaxed))
+	{
+	}
+
+	return p;
+}
+
+void ScratchArena::trim()
+{
+	if (depth > 0)
+	{
+		// Only the blocks past the one in use are free
+		size_t keep = current + 1;
+		for (size_t i = keep; i < blocks.size(); ++i)
+		{
+			total_reserved -= blocks[i].size();
+		}
+		blocks.resize(std::min(keep, blocks.size()));
+		return;
+	}
+
+	total_reserved -= reserved();
+	blocks.clear();
+	current = 0;
+	offset = 0;
+}
+
+ScratchArena::Mark ScratchArena::mark() const
+{
+	return { current, offset, in_use };
+}
+
+void ScratchArena::release(const Mark& mark)
+{
+	current = mark.block;
+	offset = mark.offset;
+	in_use = mark.in_use;
+
+	// With nothing in use, several blocks are merged into one that holds the
+	// most ever in use at once, so the next call of the same size fits in it
+	if (depth == 0 && blocks.size() > 1)
+	{
+		total_reserved -= reserved();
+		blocks.clear();
+		current = 0;
+		offset = 0;
+
+		// Runs in a destructor, so a failed allocation just leaves the arena empty
+		size_t merged = std::max(peak, MIN_BLOCK);
+		uint8_t* block = (uint8_t*)pixel_alloc(merged);
+		if (block)
+		{
+			blocks.push_back(PixelBuffer::adopt(block, merged));
+			total_reserved += merged;
+		}
+	}
+}
+
+ScratchFrame::ScratchFrame() : arena(ScratchArena::local()), start(arena.mark())
+{
+	++arena.depth;
+}
+
+ScratchFrame::~ScratchFrame()
+{
+	--arena.depth;
+	arena.release(start);
+}
+
+ScratchStats scratch_stats()
+{
+	ScratchStats stats;
+	stats.high_water = total_high_water.load();
+	stats.reserved = total_reserved.load();
+	return stats;
+}
+
+void scratch_reset_high_water()
+{
+	total_high_water = 0;
+}
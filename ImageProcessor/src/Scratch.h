@@ -0,0 +1,92 @@
+#pragma once
+#include "PixelBuffer.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-thread arena that the filter passes draw their temporaries from, so a
+// service processing frame after frame stops paying for a fresh allocation
+// (and the page faults of touching it) on every call. Memory is handed out
+// uninitialized and stack-like: a ScratchFrame marks the arena when it is
+// created and gives back everything allocated through it when it goes out of
+// scope, keeping the blocks for the next call. Each thread, pool workers
+// included, has its own arena, so no locking is involved.
+class ScratchArena
+{
+public:
+	// The calling thread's arena
+	static ScratchArena& local();
+
+	// Returns `size` bytes of 64-byte aligned, uninitialized memory that stays
+	// valid until the enclosing frame ends. Throws std::bad_alloc on failure.
+	void* allocate(size_t size);
+
+	// Frees the blocks no frame is using, returning the memory to the system
+	void trim();
+
+	// Bytes in use right now, the most ever in use at once and the bytes
+	// held in blocks by this arena
+	inline size_t used() const { return in_use; }
+	inline size_t high_water() const { return peak; }
+	size_t reserved() const;
+
+	ScratchArena() = default;
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+	~ScratchArena();
+
+private:
+	friend class ScratchFrame;
+
+	struct Mark
+	{
+		size_t block;
+		size_t offset;
+		size_t in_use;
+	};
+
+	Mark mark() const;
+	void release(const Mark& mark);
+
+	std::vector<PixelBuffer> blocks;
+	size_t current = 0; // Block allocations are taken from
+	size_t offset = 0;  // First free byte in that block
+	size_t in_use = 0;
+	size_t peak = 0;
+	int depth = 0;      // Frames open on this arena
+};
+
+// Scope of temporaries on the calling thread's arena. Frames nest: a frame
+// must end before the frame it was created in, as locals do.
+class ScratchFrame
+{
+public:
+	ScratchFrame();
+	~ScratchFrame();
+	ScratchFrame(const ScratchFrame&) = delete;
+	ScratchFrame& operator=(const ScratchFrame&) = delete;
+
+	// Uninitialized array of `count` elements, valid until the frame ends
+	template <typename T>
+	T* alloc(size_t count)
+	{
+		return static_cast<T*>(arena.allocate(count * sizeof(T)));
+	}
+
+private:
+	ScratchArena& arena;
+	ScratchArena::Mark start;
+};
+
+// Totals over every thread's arena, for sizing them: the most scratch memory
+// any one thread had in use at once, and the bytes all arenas hold right now
+struct ScratchStats
+{
+	size_t high_water = 0;
+	size_t reserved = 0;
+};
+
+ScratchStats scratch_stats();
+
+// Starts a new high-water measurement
+void scratch_reset_high_water();
@@ -0,0 +1,51 @@
+#include "Simd.h"
+#include <atomic>
+
+#if IP_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static SimdLevel detect_simd_level()
+{
+#if IP_X86 && (defined(__GNUC__) || defined(__clang__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return SIMD_SSE41;
+#elif IP_X86 && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+
+	if (max_leaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5))
+			return SIMD_AVX2;
+	}
+
+	if (sse41)
+		return SIMD_SSE41;
+#endif
+
+	return SIMD_SCALAR;
+}
+
+static std::atomic<int> simd_limit(SIMD_AVX2);
+
+SimdLevel simd_level()
+{
+	static const SimdLevel detected = detect_simd_level();
+	int limit = simd_limit.load();
+	return detected < limit ? detected : (SimdLevel)limit;
+}
+
+void simd_set_limit(SimdLevel limit)
+{
+	simd_limit = limit;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Runtime CPU dispatch for the vectorized kernels. Kernels are compiled for
+// their instruction set with IP_TARGET_* so the rest of the library keeps the
+// baseline compiler flags, and are only called when simd_level() allows it.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IP_X86 1
+#include <immintrin.h>
+#else
+#define IP_X86 0
+#endif
+
+#if IP_X86 && (defined(__GNUC__) || defined(__clang__))
+#define IP_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define IP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define IP_TARGET_SSE41
+#define IP_TARGET_AVX2
+#endif
+
+enum SimdLevel
+{
+	SIMD_SCALAR, SIMD_SSE41, SIMD_AVX2
+};
+
+// Highest instruction set supported by this CPU, capped by simd_set_limit
+SimdLevel simd_level();
+
+// Caps the instruction set the kernels may use, for testing the fallbacks and
+// for benchmarking
+void simd_set_limit(SimdLevel limit);
@@ -0,0 +1,599 @@
+#include "Stream.h"
+#include "Profile.h"
+#include "RowPipeline.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+static inline uint16_t get16le(const uint8_t* p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t get32le(const uint8_t* p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void put16le(std::vector<uint8_t>& out, uint32_t v)
+{
+	out.push_back((uint8_t)v);
+	out.push_back((uint8_t)(v >> 8));
+}
+
+static inline void put32le(std::vector<uint8_t>& out, uint32_t v)
+{
+	put16le(out, v & 0xffff);
+	put16le(out, v >> 16);
+}
+
+// Swaps the first and third byte of each pixel, turning BGR(A) into RGB(A) and back
+static void swap_red_blue(uint8_t* row, int width, int channels)
+{
+	for (int x = 0; x < width; ++x, row += channels)
+	{
+		std::swap(row[0], row[2]);
+	}
+}
+
+bool StreamReader::open(const char* filename, std::string& error)
+{
+	file.close();
+	rle_rows.clear();
+	w = h = c = 0;
+	bottom_up = bgr = opaque = false;
+
+	if (!file.open(filename))
+	{
+		error = std::string("Cannot open ") + filename;
+		return false;
+	}
+
+	const uint8_t* data = file.data();
+	bool ok;
+	if (file.size() >= 2 && data[0] == 'B' && data[1] == 'M')
+		ok = open_bmp(error);
+	else if (file.size() >= 2 && data[0] == 'P' && (data[1] == '5' || data[1] == '6'))
+		ok = open_pnm(error);
+	else
+		ok = open_tga(error);
+
+	if (!ok)
+	{
+		file.close();
+		w = h = c = 0;
+	}
+	return ok;
+}
+
+// Uncompressed 24 and 32 bit BMPs with the usual byte order. Other bit depths,
+// palettes, RLE and unusual channel masks are left to stb_image.
+bool StreamReader::open_bmp(std::string& error)
+{
+	const uint8_t* data = file.data();
+	size_t size = file.size();
+	error = "BMP cannot be streamed: only uncompressed 24 and 32 bit images are supported";
+
+	if (size < 54) return false;
+	uint32_t header = get32le(data + 14);
+	if (header != 40 && header != 56 && header != 108 && header != 124) return false;
+	if (size < 14 + (size_t)header) return false;
+
+	int32_t width = (int32_t)get32le(data + 18);
+	int32_t height = (int32_t)get32le(data + 22);
+	int bits = get16le(data + 28);
+	uint32_t compression = get32le(data + 30);
+	if (get16le(data + 26) != 1 || width <= 0 || height == 0 || height == INT32_MIN) return false;
+	if (bits != 24 && bits != 32) return false;
+	if (compression != 0 && compression != 3) return false;
+
+	// Channel masks, where stb_image takes them from
+	uint32_t red = 0xff0000, green = 0xff00, blue = 0xff, alpha = 0;
+	if (bits == 32)
+	{
+		if (header >= 108)
+		{
+			red = get32le(data + 54);
+			green = get32le(data + 58);
+			blue = get32le(data + 62);
+			alpha = get32le(data + 66);
+		}
+		else if (compression == 3)
+		{
+			if (size < 66) return false;
+			red = get32le(data + 54);
+			green = get32le(data + 58);
+			blue = get32le(data + 62);
+		}
+		else
+		{
+			alpha = 0xff000000;
+		}
+
+		if (red != 0xff0000 || green != 0xff00 || blue != 0xff || (alpha != 0 && alpha != 0xff000000)) return false;
+	}
+	else if (compression != 0)
+	{
+		return false;
+	}
+
+	w = width;
+	h = height < 0 ? -height : height;
+	c = bits == 24 || alpha == 0 ? 3 : 4;
+	pixel_bytes = bits / 8;
+	stride = ((size_t)w * pixel_bytes + 3) & ~(size_t)3;
+	pixels = get32le(data + 10);
+	bottom_up = height > 0;
+	bgr = true;
+
+	if (pixels > size || (size - pixels) / stride < (size_t)h)
+	{
+		error = "BMP cannot be streamed: file is truncated";
+		return false;
+	}
+
+	// Plain 32 bit BMPs often leave the alpha byte at 0. stb_image makes such
+	// images opaque, which needs a look at every pixel before the first row.
+	if (c == 4 && compression == 0 && header < 108)
+	{
+		opaque = true;
+		for (int y = 0; y < h && opaque; ++y)
+		{
+			const uint8_t* row = data + pixels + y * stride;
+			for (int x = 0; x < w; ++x)
+			{
+				if (row[x * 4 + 3])
+				{
+					opaque = false;
+					break;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// Truecolor and grayscale TGAs, plain or run-length encoded. Run-length
+// encoded rows are found with one pass over the packet headers, remembering
+// where each row starts, since packets may run across rows.
+bool StreamReader::open_tga(std::string& error)
+{
+	const uint8_t* data = file.data();
+	size_t size = file.size();
+	error = "Only BMP, TGA and PNM images can be streamed";
+
+	if (size < 18 || data[1] != 0) return false;
+	int type = data[2];
+	int bits = data[16];
+	int width = get16le(data + 12);
+	int height = get16le(data + 14);
+	if (type != 2 && type != 3 && type != 10 && type != 11) return false;
+	if (width == 0 || height == 0) return false;
+
+	bool gray = type == 3 || type == 11;
+	if (gray ? bits != 8 && bits != 16 : bits != 24 && bits != 32)
+	{
+		error = "TGA cannot be streamed: only 8 and 16 bit grayscale and 24 and 32 bit color images are supported";
+		return false;
+	}
+
+	w = width;
+	h = height;
+	c = bits / 8;
+	pixel_bytes = c;
+	stride = (size_t)w * c;
+	pixels = 18 + (size_t)data[0];
+	bottom_up = !(data[17] & 0x20);
+	bgr = !gray;
+
+	if (type < 8)
+	{
+		if (pixels > size || (size - pixels) / stride < (size_t)h)
+		{
+			error = "TGA cannot be streamed: file is truncated";
+			return false;
+		}
+		return true;
+	}
+
+	rle_rows.resize(h);
+	uint64_t total = (uint64_t)w * h;
+	uint64_t done = 0;
+	size_t offset = pixels;
+	int next_row = 0;
+	while (done < total)
+	{
+		if (offset >= size)
+		{
+			error = "TGA cannot be streamed: file is truncated";
+			return false;
+		}
+
+		int count = 1 + (data[offset] & 127);
+		size_t packet_bytes = 1 + (data[offset] & 128 ? 1 : count) * (size_t)pixel_bytes;
+		if (packet_bytes > size - offset)
+		{
+			error = "TGA cannot be streamed: file is truncated";
+			return false;
+		}
+
+		for (; next_row < h && (uint64_t)next_row * w < done + count; ++next_row)
+		{
+			rle_rows[next_row] = { offset, (int)((uint64_t)next_row * w - done) };
+		}
+
+		done += count;
+		offset += packet_bytes;
+	}
+
+	return true;
+}
+
+// Binary PGM and PPM with at most 8 bits per sample
+bool StreamReader::open_pnm(std::string& error)
+{
+	const uint8_t* data = file.data();
+	size_t size = file.size();
+	size_t pos = 2;
+
+	// Whitespace and comments, then a decimal number
+	auto number = [&]() -> long long
+	{
+		for (;;)
+		{
+			while (pos < size && isspace(data[pos]))
+				++pos;
+			if (pos >= size || data[pos] != '#')
+				break;
+			while (pos < size && data[pos] != '\n' && data[pos] != '\r')
+				++pos;
+		}
+
+		long long value = 0;
+		while (pos < size && isdigit(data[pos]) && value <= INT32_MAX)
+		{
+			value = value * 10 + (data[pos++] - '0');
+		}
+		return value;
+	};
+
+	long long width = number();
+	long long height = number();
+	long long maxval = number();
+	if (width <= 0 || height <= 0 || width > INT32_MAX || height > INT32_MAX || maxval <= 0 || maxval > 255)
+	{
+		error = "PNM cannot be streamed: only 8 bit binary PGM and PPM images are supported";
+		return false;
+	}
+
+	w = (int)width;
+	h = (int)height;
+	c = data[1] == '6' ? 3 : 1;
+	pixel_bytes = c;
+	stride = (size_t)w * c;
+	pixels = pos + 1; // One whitespace character ends the header
+
+	if (pixels > size || (size - pixels) / stride < (size_t)h)
+	{
+		error = "PNM cannot be streamed: file is truncated";
+		return false;
+	}
+
+	return true;
+}
+
+void StreamReader::read_rows(int y, int count, uint8_t* out) const
+{
+	size_t row_bytes = (size_t)w * c;
+	for (int i = 0; i < count; ++i)
+	{
+		read_row(y + i, out + i * row_bytes);
+	}
+}
+
+void StreamReader::release_rows(int y) const
+{
+	if (y <= 0) return;
+	y = std::min(y, h);
+
+	// A run-length encoded row may still read from the packet before the
+	// first row kept, which is at most 1 + 128 pixels long
+	size_t packet = 1 + 128 * (size_t)pixel_bytes;
+	if (rle_rows.empty())
+	{
+		if (bottom_up)
+			file.release(pixels + (size_t)(h - y) * stride, (size_t)y * stride);
+		else
+			file.release(pixels, (size_t)y * stride);
+	}
+	else if (bottom_up)
+	{
+		size_t start = y < h ? rle_rows[h - y].offset + packet : pixels;
+		if (start < file.size())
+			file.release(start, file.size() - start);
+	}
+	else
+	{
+		file.release(pixels, y < h ? rle_rows[y].offset - pixels : file.size() - pixels);
+	}
+}
+
+void StreamReader::read_row(int y, uint8_t* out) const
+{
+	const uint8_t* data = file.data();
+	int stored = bottom_up ? h - 1 - y : y;
+
+	if (!rle_rows.empty())
+	{
+		// Packets are a count byte, then one pixel repeated or `count` literal pixels
+		size_t offset = rle_rows[stored].offset;
+		int skip = rle_rows[stored].skip;
+		uint8_t* dst = out;
+		for (int x = 0; x < w; )
+		{
+			int count = 1 + (data[offset] & 127);
+			bool run = (data[offset] & 128) != 0;
+			const uint8_t* src = data + offset + 1;
+			int n = std::min(count - skip, w - x);
+
+			if (run)
+			{
+				for (int i = 0; i < n; ++i, dst += c)
+					memcpy(dst, src, c);
+				offset += 1 + c;
+			}
+			else
+			{
+				memcpy(dst, src + (size_t)skip * c, (size_t)n * c);
+				dst += (size_t)n * c;
+				offset += 1 + (size_t)count * c;
+			}
+
+			x += n;
+			skip = 0;
+		}
+
+		if (bgr) swap_red_blue(out, w, c);
+		return;
+	}
+
+	const uint8_t* src = data + pixels + stored * stride;
+	if (!bgr)
+	{
+		memcpy(out, src, (size_t)w * c);
+		return;
+	}
+
+	for (int x = 0; x < w; ++x, src += pixel_bytes, out += c)
+	{
+		out[0] = src[2];
+		out[1] = src[1];
+		out[2] = src[0];
+		if (c == 4) out[3] = opaque ? 255 : src[3];
+	}
+}
+
+bool StreamWriter::open(const char* filename, int width, int height, int channels, std::string& error)
+{
+	std::string ext = strrchr(filename, '.') ? strrchr(filename, '.') : "";
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char ch) { return (char)tolower(ch); });
+
+	if (ext == ".bmp")
+		format = BMP_FILE;
+	else if (ext == ".tga")
+		format = TGA_FILE;
+	else if (ext == ".pgm" || ext == ".ppm" || ext == ".pnm")
+		format = PNM_FILE;
+	else
+	{
+		error = std::string("Cannot stream to ") + filename + ": only BMP, TGA and PNM files can be written a strip at a time";
+		return false;
+	}
+
+	w = width;
+	h = height;
+	c = channels;
+	rows_written = 0;
+
+	std::vector<uint8_t> header;
+	if (format == BMP_FILE)
+	{
+		// Stored top row first (negative height). Four channels keep their
+		// alpha with a BITMAPV4HEADER; gray is widened to 24 bit.
+		int bits = c == 4 ? 32 : 24;
+		uint32_t header_bytes = c == 4 ? 108 : 40;
+		uint64_t stride = ((uint64_t)w * (bits / 8) + 3) & ~3ull;
+		uint64_t file_bytes = 14 + header_bytes + stride * h;
+		if (file_bytes > UINT32_MAX)
+		{
+			error = std::string("Cannot stream to ") + filename + ": image is too large for BMP";
+			return false;
+		}
+
+		header.push_back('B');
+		header.push_back('M');
+		put32le(header, (uint32_t)file_bytes);
+		put32le(header, 0);
+		put32le(header, 14 + header_bytes);
+		put32le(header, header_bytes);
+		put32le(header, (uint32_t)w);
+		put32le(header, (uint32_t)-h);
+		put16le(header, 1);
+		put16le(header, bits);
+		put32le(header, c == 4 ? 3 : 0);
+		put32le(header, (uint32_t)(stride * h));
+		put32le(header, 2835); // 72 dpi
+		put32le(header, 2835);
+		put32le(header, 0);
+		put32le(header, 0);
+		if (c == 4)
+		{
+			put32le(header, 0x00ff0000);
+			put32le(header, 0x0000ff00);
+			put32le(header, 0x000000ff);
+			put32le(header, 0xff000000);
+			put32le(header, 0x73524742); // sRGB
+			header.resize(14 + header_bytes, 0);
+		}
+		line.assign(stride, 0);
+	}
+	else if (format == TGA_FILE)
+	{
+		if (w > 65535 || h > 65535)
+		{
+			error = std::string("Cannot stream to ") + filename + ": image is too large for TGA";
+			return false;
+		}
+
+		// Uncompressed, stored top row first
+		bool alpha = c == 2 || c == 4;
+		header.resize(18, 0);
+		header[2] = c < 3 ? 3 : 2;
+		header[12] = (uint8_t)w;
+		header[13] = (uint8_t)(w >> 8);
+		header[14] = (uint8_t)h;
+		header[15] = (uint8_t)(h >> 8);
+		header[16] = (uint8_t)(c * 8);
+		header[17] = (uint8_t)(0x20 | (alpha ? 8 : 0));
+		line.resize((size_t)w * c);
+	}
+	else
+	{
+		std::string text = std::string(c < 3 ? "P5" : "P6") + "\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+		header.assign(text.begin(), text.end());
+		line.resize((size_t)w * (c < 3 ? 1 : 3));
+	}
+
+	out.open(filename, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		error = std::string("Cannot create ") + filename;
+		return false;
+	}
+
+	out.write((const char*)header.data(), header.size());
+	return (bool)out;
+}
+
+bool StreamWriter::write_rows(const uint8_t* rows, int count)
+{
+	if (!out.is_open() || count > h - rows_written) return false;
+
+	size_t row_bytes = (size_t)w * c;
+	for (int i = 0; i < count; ++i)
+	{
+		const uint8_t* src = rows + i * row_bytes;
+		const uint8_t* data = line.data();
+		uint8_t* dst = line.data();
+
+		if (format == BMP_FILE && c < 3)
+		{
+			for (int x = 0; x < w; ++x, src += c, dst += 3)
+				dst[0] = dst[1] = dst[2] = src[0];
+		}
+		else if (format == BMP_FILE)
+		{
+			for (int x = 0; x < w; ++x, src += c, dst += c)
+			{
+				dst[0] = src[2];
+				dst[1] = src[1];
+				dst[2] = src[0];
+				if (c == 4) dst[3] = src[3];
+			}
+		}
+		else if (c == 1 || (c == 2 && format == TGA_FILE) || (c == 3 && format == PNM_FILE))
+		{
+			data = src;
+		}
+		else if (format == TGA_FILE)
+		{
+			memcpy(dst, src, row_bytes);
+			swap_red_blue(dst, w, c);
+		}
+		else
+		{
+			// PNM has no alpha
+			int kept = c < 3 ? 1 : 3;
+			for (int x = 0; x < w; ++x, src += c, dst += kept)
+				memcpy(dst, src, kept);
+		}
+
+		// Rows are line.size() bytes long in every format, BMP padding included
+		out.write((const char*)data, line.size());
+	}
+
+	rows_written += count;
+	return (bool)out;
+}
+
+bool StreamWriter::finish()
+{
+	if (!out.is_open()) return false;
+
+	out.close();
+	return !out.fail() && rows_written == h;
+}
+
+bool stream_image(const char* input, const char* output, const Pipeline& pipeline, std::string& error, int strip_rows)
+{
+	StreamReader reader;
+	return reader.open(input, error) && stream_image(reader, output, pipeline, error, strip_rows);
+}
+
+bool stream_image(StreamReader& reader, const char* output, const Pipeline& pipeline, std::string& error, int strip_rows)
+{
+	std::vector<const RowStage*> stages;
+	if (!pipeline.row_stages(stages))
+	{
+		error = "Flips, crop, resize, scale, pixelize and blur by sigma need the whole image and cannot be streamed";
+		return false;
+	}
+
+	int width = reader.width();
+	int height = reader.height();
+	int channels = reader.channels();
+
+	StreamWriter writer;
+	if (!writer.open(output, width, height, channels, error)) return false;
+
+	int halo = 0;
+	for (const RowStage* stage : stages)
+	{
+		halo += stage->halo();
+	}
+
+	// Each strip of output rows needs its input rows and `halo` more on either side
+	strip_rows = std::max(1, std::min(strip_rows, height));
+	size_t row_bytes = (size_t)width * channels;
+	std::vector<uint8_t> in((size_t)std::min(height, strip_rows + 2 * halo) * row_bytes);
+	std::vector<uint8_t> out((size_t)strip_rows * row_bytes);
+
+	for (int y0 = 0; y0 < height; y0 += strip_rows)
+	{
+		int y1 = std::min(height, y0 + strip_rows);
+		int first = std::max(0, y0 - halo);
+		int last = std::min(height, y1 + halo);
+
+		reader.read_rows(first, last - first, in.data());
+		reader.release_rows(y1 - halo);
+
+		{
+			IP_PROFILE_SCOPE_NAMED(row_stages_name(stages), (uint64_t)width * (y1 - y0));
+			run_row_stages(width, height, channels, y0, y1,
+				[&](int y) -> const uint8_t* { return &in[(size_t)(y - first) * row_bytes]; },
+				[&](int y) -> uint8_t* { return &out[(size_t)(y - y0) * row_bytes]; },
+				stages);
+		}
+
+		if (!writer.write_rows(out.data(), y1 - y0)) break;
+	}
+
+	if (!writer.finish())
+	{
+		error = std::string("Cannot write ") + output;
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+#include "Pipeline.h"
+
+// Reads an image file a few rows at a time, for images too large to decode
+// whole. Supports the formats whose rows can be located without decoding the
+// rest of the file: uncompressed 24 and 32 bit BMP, TGA (truecolor or
+// grayscale, plain or run-length encoded) and binary PGM/PPM. The file is
+// memory mapped, so rows that have been read can be dropped by the kernel.
+class StreamReader
+{
+public:
+	// Returns false and sets `error` if the file cannot be streamed
+	bool open(const char* filename, std::string& error);
+
+	inline int width() const { return w; }
+	inline int height() const { return h; }
+	inline int channels() const { return c; }
+
+	// Decodes rows [y, y + count) into out, top row first and
+	// width() * channels() bytes per row, as stb_image would return them
+	void read_rows(int y, int count, uint8_t* out) const;
+
+	// Hints that rows above y will not be read again, letting the part of the
+	// file they were stored in leave memory
+	void release_rows(int y) const;
+
+private:
+	bool open_bmp(std::string& error);
+	bool open_tga(std::string& error);
+	bool open_pnm(std::string& error);
+	void read_row(int y, uint8_t* out) const;
+
+	// Where a stored row of a run-length encoded TGA starts: the packet holding
+	// its first pixel, and how many of that packet's pixels belong to earlier rows
+	struct RleRow
+	{
+		size_t offset;
+		int skip;
+	};
+
+	MappedFile file;
+	int w = 0;
+	int h = 0;
+	int c = 0;
+	size_t pixels = 0;        // Offset of the first stored row
+	size_t stride = 0;        // Bytes per stored row, when uncompressed
+	int pixel_bytes = 0;      // Bytes per stored pixel
+	bool bottom_up = false;   // Rows are stored bottom row first
+	bool bgr = false;         // Color pixels are stored blue first
+	bool opaque = false;      // Alpha is all zero and read as 255, as stb_image does
+	std::vector<RleRow> rle_rows;
+};
+
+// Writes an image file row by row, top row first, without holding the image.
+// The format follows the extension: .bmp, .tga, .pgm, .ppm or .pnm (PGM for
+// 1 or 2 channels, PPM otherwise). BMP and PNM have no alpha for 2 channel
+// images and PNM none for 4 channel images, so it is dropped there.
+class StreamWriter
+{
+public:
+	bool open(const char* filename, int width, int height, int channels, std::string& error);
+
+	// Appends `count` rows of width * channels bytes
+	bool write_rows(const uint8_t* rows, int count);
+
+	// Flushes and closes the file. Returns false if any write failed or fewer
+	// rows than the height were written.
+	bool finish();
+
+private:
+	enum Format
+	{
+		BMP_FILE, TGA_FILE, PNM_FILE
+	};
+
+	std::ofstream out;
+	std::vector<uint8_t> line;
+	Format format = BMP_FILE;
+	int w = 0;
+	int h = 0;
+	int c = 0;
+	int rows_written = 0;
+};
+
+// Runs pipeline over input and writes the result to output `strip_rows` rows
+// at a time, so memory use depends on the image width and strip height but not
+// on the image height. Both files must be streamable formats, and the pipeline
+// may only hold row operations (per-pixel operations, blur by strength, edge
+// detection and sharpen). The output is identical to reading the whole image,
+// applying the pipeline and writing it. Returns false and sets `error` on
+// failure.
+bool stream_image(const char* input, const char* output, const Pipeline& pipeline, std::string& error, int strip_rows = 256);
+
+// The same, reading from an opened reader
+bool stream_image(StreamReader& reader, const char* output, const Pipeline& pipeline, std::string& error, int strip_rows = 256);
@@ -0,0 +1,153 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+static std::mutex pool_mutex;
+static std::unique_ptr<ThreadPool> pool;
+static int requested_workers = 0;
+
+static int resolve_worker_count(int count)
+{
+	if (count > 0) return count;
+
+	int hardware = (int)std::thread::hardware_concurrency();
+	return hardware > 0 ? hardware : 1;
+}
+
+ThreadPool& ThreadPool::instance()
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	if (!pool)
+		pool.reset(new ThreadPool(resolve_worker_count(requested_workers)));
+
+	return *pool;
+}
+
+void ThreadPool::set_worker_count(int count)
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	requested_workers = count;
+	pool.reset();
+}
+
+int ThreadPool::worker_count()
+{
+	return instance().threads;
+}
+
+ThreadPool::ThreadPool(int threads) : threads(threads)
+{
+	// The caller of parallel_for is the remaining worker
+	for (int i = 1; i < threads; ++i)
+	{
+		workers.emplace_back(&ThreadPool::worker_loop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+bool ThreadPool::run_chunks(Job& job)
+{
+	bool ran = false;
+
+	for (int chunk = job.next++; chunk < job.chunks; chunk = job.next++)
+	{
+		int begin = chunk * job.grain;
+		int end = std::min(job.count, begin + job.grain);
+		(*job.fn)(begin, end);
+		ran = true;
+
+		if (++job.done == job.chunks)
+		{
+			std::lock_guard<std::mutex> lock(job.mutex);
+			job.finished.notify_all();
+		}
+	}
+
+	return ran;
+}
+
+void ThreadPool::worker_loop()
+{
+	for (;;)
+	{
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (stopping) return;
+
+			job = jobs.front();
+			if (job->next >= job->chunks)
+			{
+				// Every chunk has been claimed, stop handing this job out
+				jobs.pop_front();
+				continue;
+			}
+		}
+
+		run_chunks(*job);
+	}
+}
+
+void ThreadPool::parallel_for(int count, int grain, const std::function<void(int, int)>& fn)
+{
+	if (count <= 0) return;
+
+	grain = std::max(1, grain);
+	int chunks = (count + grain - 1) / grain;
+
+	if (chunks == 1 || workers.empty())
+	{
+		fn(0, count);
+		return;
+	}
+
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->fn = &fn;
+	job->count = count;
+	job->grain = grain;
+	job->chunks = chunks;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	wake.notify_all();
+
+	run_chunks(*job);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::deque<std::shared_ptr<Job>>::iterator it = std::find(jobs.begin(), jobs.end(), job);
+		if (it != jobs.end())
+			jobs.erase(it);
+	}
+
+	std::unique_lock<std::mutex> lock(job->mutex);
+	job->finished.wait(lock, [&job] { return job->done == job->chunks; });
+}
+
+void parallel_rows(int height, size_t row_bytes, const std::function<void(int, int)>& fn)
+{
+	ThreadPool& threads = ThreadPool::instance();
+
+	// Aim for a few bands per worker for load balancing, but keep each band
+	// large enough that scheduling overhead stays negligible
+	int workers = ThreadPool::worker_count();
+	int rows = (height + workers * 4 - 1) / (workers * 4);
+	int min_rows = (int)std::max<size_t>(1, (64 * 1024) / std::max<size_t>(1, row_bytes));
+
+	threads.parallel_for(height, std::max(rows, min_rows), fn);
+}
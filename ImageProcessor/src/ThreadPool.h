@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Internal worker pool shared by the filter passes. The calling thread always
+// takes part in its own jobs, so parallel_for may be called from any thread
+// (including pool workers) without deadlocking.
+class ThreadPool
+{
+public:
+	static ThreadPool& instance();
+
+	// 0 selects std::thread::hardware_concurrency(). Must not be called while
+	// an operation is running on the pool.
+	static void set_worker_count(int count);
+	static int worker_count();
+
+	// Calls fn(begin, end) for consecutive chunks of [0, count), each holding at
+	// least `grain` items, and returns once every chunk has completed
+	void parallel_for(int count, int grain, const std::function<void(int, int)>& fn);
+
+	~ThreadPool();
+
+private:
+	struct Job
+	{
+		const std::function<void(int, int)>* fn;
+		int count;
+		int grain;
+		int chunks;
+		std::atomic<int> next{ 0 };
+		std::atomic<int> done{ 0 };
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+
+	explicit ThreadPool(int threads);
+	void worker_loop();
+	static bool run_chunks(Job& job);
+
+	int threads;
+	std::vector<std::thread> workers;
+	std::deque<std::shared_ptr<Job>> jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
+
+// Splits [0, height) into row bands sized for the pool and calls
+// fn(y_begin, y_end) for each. Kernels that read neighbouring rows must read
+// from a buffer that no band writes to, so halo rows can be shared freely.
+void parallel_rows(int height, size_t row_bytes, const std::function<void(int, int)>& fn);
@@ -1,19 +1,391 @@
-#pragma once
-#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Batch.h"
 #include "Image.h"
+#include "Pipeline.h"
+#include "Profile.h"
+#include "RowPipeline.h"
 
 
-int main()
+static void print_usage()
 {
-	Image img("image.jpg");
+	printf(
+		"Usage: ImageProcessor [options] <file or directory>... -o <output directory>\n"
+		"\n"
+		"Options:\n"
+		"  -o, --output DIR       directory for the processed images\n"
+		"  -f, --format EXT       write png, jpg, bmp or tga instead of the input format\n"
+		"  -j, --jobs N           files processed at once (default: one per hardware\n"
+		"                         thread); at most N + 2 decoded images are held\n"
+		"      --io-jobs N        files decoded and encoded at once, each (default: N / 2)\n"
+		"  -t, --threads N        threads used within each file (default: hardware threads / jobs)\n"
+		"  -r, --recursive        include images in subdirectories\n"
+		"  -s, --read-scale N     read images at 1/N size (2, 4 or 8) before the\n"
+		"                         operations; JPEGs are decoded straight at that size\n"
+		"      --stream           process BMP, TGA and PNM files a strip of rows at a\n"
+		"                         time, for images larger than memory (row operations\n"
+		"                         only; -f may also be ppm or pgm)\n"
+		"      --strip-rows N     rows per strip when streaming (default 256)\n"
+		"  -p, --preset NAME      encoder settings: fastest, balanced or smallest\n"
+		"                         (default: JPEG quality 100, PNG level 8)\n"
+		"      --quality N        JPEG quality from 1 to 100, overriding the preset\n"
+		"  -q, --quiet            only print the summary\n"
+		"      --profile FILE     time every operation, print a table of the timings\n"
+		"                         and save them as a Chrome trace to FILE (needs a\n"
+		"                         build with IMAGE_PROCESSOR_PROFILE)\n"
+		"  -h, --help             show this message\n"
+		"\n"
+		"Operations, applied in the order given:\n"
+		"  --flip-x, --flip-y\n"
+		"  --rotate DEGREES       90, 180 or 270, clockwise\n"
+		"  --transpose\n"
+		"  --crop X,Y,WxH\n"
+		"  --filter NAME          nearest, bilinear, bicubic or lanczos3 for the\n"
+		"                         following resize and scale operations\n"
+		"  --resize WxH\n"
+		"  --scale RATIO\n"
+		"  --grayscale-avg, --grayscale-lum\n"
+		"  --color-mask R,G,B\n"
+		"  --pixelize STRENGTH\n"
+		"  --blur STRENGTH          strength between 1 and 4\n"
+		"  --blur-sigma SIGMA\n"
+		"  --edge-detection[=CUTOFF]\n"
+		"  --sharpen\n");
+}
+
+static bool parse_filter(const char* text, ResizeFilter& filter)
+{
+	struct NamedFilter
+	{
+		const char* name;
+		ResizeFilter filter;
+	};
+
+	static const NamedFilter filters[] = { { "nearest", NEAREST }, { "bilinear", BILINEAR }, { "bicubic", BICUBIC }, { "lanczos3", LANCZOS3 } };
+
+	for (const auto& entry : filters)
+	{
+		if (strcmp(text, entry.name) == 0)
+		{
+			filter = entry.filter;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool parse_preset(const char* text, WriteOptions& options)
+{
+	if (strcmp(text, "fastest") == 0)
+		options = WriteOptions::fastest();
+	else if (strcmp(text, "balanced") == 0)
+		options = WriteOptions::balanced();
+	else if (strcmp(text, "smallest") == 0)
+		options = WriteOptions::smallest();
+	else
+		return false;
+
+	return true;
+}
+
+static bool parse_size(const char* text, int& w, int& h)
+{
+	return sscanf(text, "%dx%d", &w, &h) == 2 && w > 0 && h > 0;
+}
+
+// Adds the operation named by `option` to the pipeline, taking its argument
+// from `value`. Returns false if the option is unknown or the value is invalid.
+// Operations with an optional argument only take it from "--name=value".
+static bool add_operation(Pipeline& pipeline, const std::string& option, const char* value, bool inline_value, ResizeFilter filter, bool& used_value)
+{
+	used_value = false;
+
+	if (option == "--flip-x")
+		pipeline.flipX();
+	else if (option == "--flip-y")
+		pipeline.flipY();
+	else if (option == "--transpose")
+		pipeline.transpose();
+	else if (option == "--grayscale-avg")
+		pipeline.grayscale_avg();
+	else if (option == "--grayscale-lum")
+		pipeline.grayscale_lum();
+	else if (option == "--sharpen")
+		pipeline.sharpen();
+	else if (option == "--edge-detection")
+		inline_value ? pipeline.edge_detection(atof(value)) : pipeline.edge_detection();
+	else
+	{
+		// The remaining operations take an argument
+		if (!value) return false;
+		used_value = true;
+
+		if (option == "--rotate")
+		{
+			int degrees = atoi(value);
+			if (degrees == 90)
+				pipeline.rotate90();
+			else if (degrees == 180)
+				pipeline.rotate180();
+			else if (degrees == 270)
+				pipeline.rotate270();
+			else
+				return false;
+		}
+		else if (option == "--crop")
+		{
+			int x, y, w, h;
+			if (sscanf(value, "%d,%d,%dx%d", &x, &y, &w, &h) != 4 || x < 0 || y < 0 || w <= 0 || h <= 0) return false;
+			pipeline.crop(x, y, h, w);
+		}
+		else if (option == "--resize")
+		{
+			int w, h;
+			if (!parse_size(value, w, h)) return false;
+			pipeline.resize(w, h, filter);
+		}
+		else if (option == "--scale")
+		{
+			double ratio = atof(value);
+			if (ratio <= 0) return false;
+			pipeline.scale(ratio, filter);
+		}
+		else if (option == "--color-mask")
+		{
+			float r, g, b;
+			if (sscanf(value, "%f,%f,%f", &r, &g, &b) != 3) return false;
+			pipeline.color_mask(r, g, b);
+		}
+		else if (option == "--pixelize")
+		{
+			int strength = atoi(value);
+			if (strength <= 0) return false;
+			pipeline.pixelize(strength);
+		}
+		else if (option == "--blur")
+		{
+			pipeline.gaussian_blur(atoi(value));
+		}
+		else if (option == "--blur-sigma")
+		{
+			double sigma = atof(value);
+			if (!(sigma > 0) || !std::isfinite(sigma)) return false;
+			pipeline.gaussian_blur_sigma(sigma);
+		}
+		else
+			return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::string> inputs;
+	std::string output_dir;
+	std::string format;
+	int threads = 0;
+	int quality = 0;
+	bool recursive = false;
+	bool quiet = false;
+	const char* trace = nullptr;
+	BatchOptions options;
+	ResizeFilter filter = NEAREST;
+	Pipeline pipeline;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+
+		if (arg.size() < 2 || arg[0] != '-')
+		{
+			inputs.push_back(arg);
+			continue;
+		}
+
+		// Options take their value from "--name=value" or from the next argument
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool inline_value = false;
+		size_t equals = arg.find('=');
+		if (equals != std::string::npos)
+		{
+			value = argv[i] + equals + 1;
+			arg = arg.substr(0, equals);
+			inline_value = true;
+		}
+
+		if (arg == "-h" || arg == "--help")
+		{
+			print_usage();
+			return 0;
+		}
+		else if (arg == "-r" || arg == "--recursive")
+			recursive = true;
+		else if (arg == "-q" || arg == "--quiet")
+			quiet = true;
+		else if (arg == "--stream")
+			options.stream = true;
+		else if (arg == "--profile" && value)
+		{
+			if (!IP_PROFILE)
+			{
+				fprintf(stderr, "--profile needs a build with IMAGE_PROCESSOR_PROFILE enabled\n");
+				return 2;
+			}
+
+			trace = value;
+			if (!inline_value) ++i;
+		}
+		else if (arg == "--strip-rows" && value)
+		{
+			options.strip_rows = atoi(value);
+			if (options.strip_rows <= 0)
+			{
+				fprintf(stderr, "Strip rows must be positive\n");
+				return 2;
+			}
+
+			if (!inline_value) ++i;
+		}
+		else if ((arg == "-p" || arg == "--preset") && value)
+		{
+			if (!parse_preset(value, options.write))
+			{
+				fprintf(stderr, "Unknown preset %s\n", value);
+				return 2;
+			}
+
+			if (!inline_value) ++i;
+		}
+		else if (arg == "--quality" && value)
+		{
+			quality = atoi(value);
+			if (quality < 1 || quality > 100)
+			{
+				fprintf(stderr, "Quality must be between 1 and 100\n");
+				return 2;
+			}
+
+			if (!inline_value) ++i;
+		}
+		else if (arg == "--filter" && value)
+		{
+			if (!parse_filter(value, filter))
+			{
+				fprintf(stderr, "Unknown filter %s\n", value);
+				return 2;
+			}
+
+			if (!inline_value) ++i;
+		}
+		else if ((arg == "-s" || arg == "--read-scale") && value)
+		{
+			options.read.downscale = atoi(value);
+			if (options.read.downscale != 1 && options.read.downscale != 2 && options.read.downscale != 4 && options.read.downscale != 8)
+			{
+				fprintf(stderr, "Read scale must be 1, 2, 4 or 8\n");
+				return 2;
+			}
+
+			if (!inline_value) ++i;
+		}
+		else if ((arg == "-o" || arg == "--output" || arg == "-f" || arg == "--format" || arg == "-j" || arg == "--jobs" || arg == "--io-jobs" || arg == "-t" || arg == "--threads") && value)
+		{
+			if (arg == "-o" || arg == "--output")
+				output_dir = value;
+			else if (arg == "-f" || arg == "--format")
+				format = std::string(".") + value;
+			else if (arg == "-j" || arg == "--jobs")
+				options.jobs = atoi(value);
+			else if (arg == "--io-jobs")
+				options.io_jobs = atoi(value);
+			else
+				threads = atoi(value);
+
+			if (!inline_value) ++i;
+		}
+		else
+		{
+			bool used_value;
+			if (!add_operation(pipeline, arg, value, inline_value, filter, used_value))
+			{
+				fprintf(stderr, "Invalid option %s\n\n", argv[i]);
+				print_usage();
+				return 2;
+			}
+
+			if (used_value && !inline_value) ++i;
+		}
+	}
+
+	if (inputs.empty() || output_dir.empty())
+	{
+		print_usage();
+		return 2;
+	}
+
+	if (quality > 0)
+		options.write.jpeg_quality = quality;
+
+	bool pnm = format == ".ppm" || format == ".pgm" || format == ".pnm";
+	if (!format.empty() && format != ".png" && format != ".jpg" && format != ".bmp" && format != ".tga" && !(options.stream && pnm))
+	{
+		fprintf(stderr, "Unsupported format %s\n", format.c_str() + 1);
+		return 2;
+	}
+
+	std::vector<const RowStage*> stages;
+	if (options.stream && !pipeline.row_stages(stages))
+	{
+		fprintf(stderr, "--stream only supports --grayscale-avg, --grayscale-lum, --color-mask, --blur, --edge-detection and --sharpen\n");
+		return 2;
+	}
+
+	std::vector<BatchItem> items;
+	std::string error;
+	if (!plan_batch(inputs, output_dir, format, recursive, items, error))
+	{
+		fprintf(stderr, "%s\n", error.c_str());
+		return 2;
+	}
+
+	// Split the machine between files in flight and threads within each file
+	int hardware = std::max(1, (int)std::thread::hardware_concurrency());
+	if (options.jobs <= 0)
+		options.jobs = hardware;
+	options.jobs = std::max(1, std::min(options.jobs, (int)items.size()));
+	Image::set_thread_count(threads > 0 ? threads : std::max(1, hardware / options.jobs));
+
+	profile_set_enabled(trace != nullptr);
+	BatchSummary summary = run_batch(items, pipeline, options, [&](const BatchFileResult& result)
+	{
+		if (!result.ok)
+			fprintf(stderr, "Failed to %s %s%s%s\n", result.error, strcmp(result.error, "write") != 0 ? result.item->input.c_str() : result.item->output.c_str(),
+				result.message.empty() ? "" : ": ", result.message.c_str());
+		else if (!quiet)
+			printf("%s -> %s  %dx%d  read %.1f ms, process %.1f ms, write %.1f ms\n", result.item->input.c_str(), result.item->output.c_str(),
+				result.width, result.height, result.read_ms, result.process_ms, result.write_ms);
+	});
+
+	double seconds = std::max(summary.seconds, 1e-9);
+	printf("Processed %d files (%d failed) in %.2f s: %.1f files/s, %.1f MPix/s\n", summary.files, summary.failed, summary.seconds,
+		(summary.files - summary.failed) / seconds, summary.pixels / seconds / 1e6);
 
-	if (img.is_valid())
+	if (trace)
 	{
-		// Manipulate images here
-		img.write("new-image.jpg");
+		printf("\n%s", profile_summary().c_str());
+		if (profile_write_trace(trace))
+			printf("Trace written to %s\n", trace);
+		else
+			fprintf(stderr, "Failed to write %s\n", trace);
 	}
 
-	std::cout << "Finished processing images." << std::endl;
-	std::cin.get();
-	return 0;
+	return summary.failed ? 1 : 0;
 }
@@ -491,6 +491,12 @@ extern "C" {
     // calling it will fail to link if your compiler doesn't
     STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+    // decode JPEGs on the calling thread at 1/denominator of their size, where
+    // denominator is 1, 2, 4 or 8 (other values are treated as 1). each output
+    // pixel is the mean of the block it covers and sizes round up, so a 1001x7
+    // image decoded at 1/2 is 501x4. other formats are unaffected
+    STBIDEF void stbi_set_jpeg_scale_thread(int denominator);
+
     // ZLIB client - used by PNG, available for other purposes
 
     STBIDEF char* stbi_zlib_decode_malloc_guesssize(const char* buffer, int len, int initial_size, int* outlen);
@@ -1080,6 +1086,18 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL
+#else
+static
+#endif
+int stbi__jpeg_scale_shift = 0;
+
+STBIDEF void stbi_set_jpeg_scale_thread(int denominator)
+{
+    stbi__jpeg_scale_shift = denominator == 2 ? 1 : denominator == 4 ? 2 : denominator == 8 ? 3 : 0;
+}
+
 static void* stbi__load_main(stbi__context* s, int* x, int* y, int* comp, int req_comp, stbi__result_info* ri, int bpc)
 {
     memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1935,6 +1953,9 @@ typedef struct
     int scan_n, order[4];
     int restart_interval, todo;
 
+    // decoded size of an 8x8 block: 8, or 4, 2 or 1 when decoding at reduced scale
+    int idct_size;
+
     // kernels
     void (*idct_block_kernel)(stbi_uc* out, int out_stride, short data[64]);
     void (*YCbCr_to_RGB_kernel)(stbi_uc* out, const stbi_uc* y, const stbi_uc* pcb, const stbi_uc* pcr, int count, int step);
@@ -2885,6 +2906,45 @@ static void stbi__jpeg_reset(stbi__jpeg* j)
     // since we don't even allow 1<<30 pixels
 }
 
+// runs the IDCT for one block, writing idct_size x idct_size pixels. when
+// decoding at reduced scale each output pixel is the rounded mean of the
+// pixels the full IDCT produces under it, so the result matches decoding in
+// full and averaging, without upsampling and color converting the extra pixels
+static void stbi__jpeg_idct(stbi__jpeg* z, stbi_uc* out, int out_stride, short data[64])
+{
+    STBI_SIMD_ALIGN(stbi_uc, block[64]);
+    int n = z->idct_size, x, y;
+
+    if (n == 8) {
+        z->idct_block_kernel(out, out_stride, data);
+        return;
+    }
+    if (n == 1) {
+        // the DC term is 8 times the block mean, so no IDCT is needed
+        out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+        return;
+    }
+
+    z->idct_block_kernel(block, 8, data);
+    if (n == 4) {
+        for (y = 0; y < 4; ++y, out += out_stride) {
+            stbi_uc* r0 = block + y * 16, * r1 = r0 + 8;
+            for (x = 0; x < 4; ++x)
+                out[x] = (stbi_uc)((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+        }
+    }
+    else {
+        for (y = 0; y < 2; ++y, out += out_stride) {
+            int sum[8];
+            stbi_uc* r = block + y * 32;
+            for (x = 0; x < 8; ++x)
+                sum[x] = r[x] + r[x + 8] + r[x + 16] + r[x + 24];
+            out[0] = (stbi_uc)((sum[0] + sum[1] + sum[2] + sum[3] + 8) >> 4);
+            out[1] = (stbi_uc)((sum[4] + sum[5] + sum[6] + sum[7] + 8) >> 4);
+        }
+    }
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
 {
     stbi__jpeg_reset(z);
@@ -2903,7 +2963,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
                 for (i = 0; i < w; ++i) {
                     int ha = z->img_comp[n].ha;
                     if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                    z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+                    stbi__jpeg_idct(z, z->img_comp[n].data + (z->img_comp[n].w2 * j + i) * z->idct_size, z->img_comp[n].w2, data);
                     // every data block is an MCU, so countdown the restart interval
                     if (--z->todo <= 0) {
                         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2928,11 +2988,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
                         // by the basic H and V specified for the component
                         for (y = 0; y < z->img_comp[n].v; ++y) {
                             for (x = 0; x < z->img_comp[n].h; ++x) {
-                                int x2 = (i * z->img_comp[n].h + x) * 8;
-                                int y2 = (j * z->img_comp[n].v + y) * 8;
+                                int x2 = (i * z->img_comp[n].h + x) * z->idct_size;
+                                int y2 = (j * z->img_comp[n].v + y) * z->idct_size;
                                 int ha = z->img_comp[n].ha;
                                 if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                                z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
+                                stbi__jpeg_idct(z, z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
                             }
                         }
                     }
@@ -3032,7 +3092,7 @@ static void stbi__jpeg_finish(stbi__jpeg* z)
                 for (i = 0; i < w; ++i) {
                     short* data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                     stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-                    z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+                    stbi__jpeg_idct(z, z->img_comp[n].data + (z->img_comp[n].w2 * j + i) * z->idct_size, z->img_comp[n].w2, data);
                 }
             }
         }
@@ -3267,8 +3327,8 @@ static int stbi__process_frame_header(stbi__jpeg* z, int scan)
         //
         // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
         // so these muls can't overflow with 32-bit ints (which we require)
-        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * z->idct_size;
+        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * z->idct_size;
         z->img_comp[i].coeff = 0;
         z->img_comp[i].raw_coeff = 0;
         z->img_comp[i].linebuf = NULL;
@@ -3278,10 +3338,10 @@ static int stbi__process_frame_header(stbi__jpeg* z, int scan)
         // align blocks for idct using mmx/sse
         z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
         if (z->progressive) {
-            // w2, h2 are multiples of 8 (see above)
-            z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-            z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-            z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+            // one 8x8 block of coefficients per block, whatever size it decodes to
+            z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+            z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+            z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
             if (z->img_comp[i].raw_coeff == NULL)
                 return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
             z->img_comp[i].coeff = (short*)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3744,6 +3804,7 @@ static void stbi__setup_jpeg(stbi__jpeg* j)
     j->idct_block_kernel = stbi__idct_block;
     j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
     j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
+    j->idct_size = 8 >> stbi__jpeg_scale_shift;
 
 #ifdef STBI_SSE2
     if (stbi__sse2_available()) {
@@ -3794,6 +3855,18 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp
     // load a jpeg image from whichever source, but leave in YCbCr format
     if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+    // the components were decoded at reduced scale, so everything from here on
+    // works on the smaller image
+    if (z->idct_size < 8) {
+        unsigned int f = 8 / z->idct_size;
+        z->s->img_x = (z->s->img_x + f - 1) / f;
+        z->s->img_y = (z->s->img_y + f - 1) / f;
+        for (n = 0; n < z->s->img_n; ++n) {
+            z->img_comp[n].x = (z->img_comp[n].x + f - 1) / f;
+            z->img_comp[n].y = (z->img_comp[n].y + f - 1) / f;
+        }
+    }
+
     // determine actual number of components to generate
     n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -5461,7 +5534,7 @@ static void* stbi__bmp_load(stbi__context* s, int* x, int* y, int* comp, int req
     }
     if (psize == 0) {
         STBI_ASSERT(info.offset == s->callback_already_read + (int)(s->img_buffer - s->img_buffer_original));
-        if (info.offset != s->callback_already_read + (s->img_buffer - s->buffer_start)) {
+        if (info.offset != s->callback_already_read + (s->img_buffer - s->img_buffer_original)) {
             return stbi__errpuc("bad offset", "Corrupt BMP");
         }
     }
@@ -7251,7 +7324,7 @@ static int stbi__bmp_info(stbi__context* s, int* x, int* y, int* comp)
     if (p == NULL)
         return 0;
     if (x) *x = s->img_x;
-    if (y) *y = s->img_y;
+    if (y) *y = abs((int)s->img_y);
     if (comp) {
         if (info.bpp == 24 && info.ma == 0xff000000)
             *comp = 3;
@@ -97,7 +97,8 @@ USAGE:
    at the end of the line.)
 
    PNG allows you to set the deflate compression level by setting the global
-   variable 'stbi_write_png_compression_level' (it defaults to 8).
+   variable 'stbi_write_png_compression_level' (it defaults to 8). Levels 1
+   and 2 skip lazy matching, which makes them about a third faster.
 
    HDR expects linear float data. Since the format is always 32-bit rgb(e)
    data, alpha (if provided) is discarded, and for monochrome data it is
@@ -191,8 +192,26 @@ STBIWDEF int stbi_write_tga_to_func(stbi_write_func* func, void* context, int w,
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func* func, void* context, int w, int h, int comp, const float* data);
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func* func, void* context, int x, int y, int comp, const void* data, int quality);
 
+// Variants taking as arguments what the functions above read from globals
+// (additions to stb). subsample: 1 for 4:2:0 chroma, 0 for 4:4:4, -1 to choose
+// by quality as stbi_write_jpg does. rle: nonzero to run-length encode.
+STBIWDEF int stbi_write_jpg_to_func_subsampled(stbi_write_func* func, void* context, int x, int y, int comp, const void* data, int quality, int subsample);
+STBIWDEF int stbi_write_tga_to_func_rle(stbi_write_func* func, void* context, int x, int y, int comp, const void* data, int rle);
+
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
+// Pieces of the PNG writer for encoding an image in parallel (additions to stb).
+// stbi_write_png_filter_rows filters rows [row_begin, row_end) of an x by y
+// image into out, each as a filter byte followed by x*n bytes. force_filter
+// is 0 to 4 for one filter on every row, or -1 to choose each row's filter as
+// stbi_write_png does. stbi_zlib_compress_part deflates data as one
+// piece of a larger zlib stream: it writes no zlib header or Adler-32, and
+// unless `last` ends on a byte boundary with an empty stored block, so the
+// next piece can be appended directly. Returns NULL if STBIW_ZLIB_COMPRESS
+// replaces the builtin compressor. Free the result with STBIW_FREE.
+STBIWDEF void stbi_write_png_filter_rows(const unsigned char* pixels, int stride_bytes, int x, int y, int n, int row_begin, int row_end, int force_filter, unsigned char* out);
+STBIWDEF unsigned char* stbi_zlib_compress_part(unsigned char* data, int data_len, int* out_len, int quality, int last);
+
 #endif//INCLUDE_STB_IMAGE_WRITE_H
 
 #ifdef STB_IMAGE_WRITE_IMPLEMENTATION
@@ -520,7 +539,7 @@ STBIWDEF int stbi_write_bmp(char const* filename, int x, int y, int comp, const
 }
 #endif //!STBI_WRITE_NO_STDIO
 
-static int stbi_write_tga_core(stbi__write_context* s, int x, int y, int comp, void* data)
+static int stbi_write_tga_core(stbi__write_context* s, int x, int y, int comp, void* data, int rle)
 {
     int has_alpha = (comp == 2 || comp == 4);
     int colorbytes = has_alpha ? comp - 1 : comp;
@@ -529,7 +548,7 @@ static int stbi_write_tga_core(stbi__write_context* s, int x, int y, int comp, v
     if (y < 0 || x < 0)
         return 0;
 
-    if (!stbi_write_tga_with_rle) {
+    if (!rle) {
         return stbiw__outfile(s, -1, -1, x, y, comp, 0, (void*)data, has_alpha, 0,
             "111 221 2222 11", 0, 0, format, 0, 0, 0, 0, 0, x, y, (colorbytes + has_alpha) * 8, has_alpha * 8);
     }
@@ -609,7 +628,14 @@ STBIWDEF int stbi_write_tga_to_func(stbi_write_func* func, void* context, int x,
 {
     stbi__write_context s = { 0 };
     stbi__start_write_callbacks(&s, func, context);
-    return stbi_write_tga_core(&s, x, y, comp, (void*)data);
+    return stbi_write_tga_core(&s, x, y, comp, (void*)data, stbi_write_tga_with_rle);
+}
+
+STBIWDEF int stbi_write_tga_to_func_rle(stbi_write_func* func, void* context, int x, int y, int comp, const void* data, int rle)
+{
+    stbi__write_context s = { 0 };
+    stbi__start_write_callbacks(&s, func, context);
+    return stbi_write_tga_core(&s, x, y, comp, (void*)data, rle);
 }
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -617,7 +643,7 @@ STBIWDEF int stbi_write_tga(char const* filename, int x, int y, int comp, const
 {
     stbi__write_context s = { 0 };
     if (stbi__start_write_file(&s, filename)) {
-        int r = stbi_write_tga_core(&s, x, y, comp, (void*)data);
+        int r = stbi_write_tga_core(&s, x, y, comp, (void*)data, stbi_write_tga_with_rle);
         stbi__end_write_file(&s);
         return r;
     }
@@ -892,12 +918,11 @@ static unsigned int stbiw__zhash(unsigned char* data)
 
 #endif // STBIW_ZLIB_COMPRESS
 
-STBIWDEF unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality)
+#ifndef STBIW_ZLIB_COMPRESS
+// header: write the zlib header and Adler-32; last: set BFINAL, otherwise end
+// with an empty stored block (a sync flush)
+static unsigned char* stbiw__zlib_compress(unsigned char* data, int data_len, int* out_len, int quality, int header, int last)
 {
-#ifdef STBIW_ZLIB_COMPRESS
-    // user provided a zlib compress implementation, use that
-    return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
-#else // use builtin
     static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
     static unsigned char  lengtheb[] = { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
     static unsigned short distc[] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
@@ -908,11 +933,13 @@ STBIWDEF unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, in
     unsigned char*** hash_table = (unsigned char***)STBIW_MALLOC(stbiw__ZHASH * sizeof(unsigned char**));
     if (hash_table == NULL)
         return NULL;
-    if (quality < 5) quality = 5;
+    if (quality < 1) quality = 1;
 
-    stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
-    stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
-    stbiw__zlib_add(1, 1);  // BFINAL = 1
+    if (header) {
+        stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
+        stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
+    }
+    stbiw__zlib_add(last ? 1 : 0, 1);  // BFINAL
     stbiw__zlib_add(1, 2);  // BTYPE = 1 -- fixed huffman
 
     for (i = 0; i < stbiw__ZHASH; ++i)
@@ -938,7 +965,7 @@ STBIWDEF unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, in
         }
         stbiw__sbpush(hash_table[h], data + i);
 
-        if (bestloc) {
+        if (bestloc && quality > 2) {
             // "lazy matching" - check match at *next* byte, and if it's better, do cur byte as literal
             h = stbiw__zhash(data + i + 1) & (stbiw__ZHASH - 1);
             hlist = hash_table[h];
@@ -974,15 +1001,23 @@ STBIWDEF unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, in
     for (; i < data_len; ++i)
         stbiw__zlib_huffb(data[i]);
     stbiw__zlib_huff(256); // end of block
+    if (!last)
+        stbiw__zlib_add(0, 3);  // BFINAL = 0, BTYPE = 0 -- empty stored block
     // pad with 0 bits to byte boundary
     while (bitcount)
         stbiw__zlib_add(0, 1);
+    if (!last) {
+        stbiw__sbpush(out, 0x00);  // LEN = 0
+        stbiw__sbpush(out, 0x00);
+        stbiw__sbpush(out, 0xff);  // NLEN
+        stbiw__sbpush(out, 0xff);
+    }
 
     for (i = 0; i < stbiw__ZHASH; ++i)
         (void)stbiw__sbfree(hash_table[i]);
     STBIW_FREE(hash_table);
 
-    {
+    if (header) {
         // compute adler32 on input
         unsigned int s1 = 1, s2 = 0;
         int blocklen = (int)(data_len % 5552);
@@ -1002,6 +1037,27 @@ STBIWDEF unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, in
     // make returned pointer freeable
     STBIW_MEMMOVE(stbiw__sbraw(out), out, *out_len);
     return (unsigned char*)stbiw__sbraw(out);
+}
+#endif // STBIW_ZLIB_COMPRESS
+
+STBIWDEF unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality)
+{
+#ifdef STBIW_ZLIB_COMPRESS
+    // user provided a zlib compress implementation, use that
+    return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
+#else // use builtin
+    return stbiw__zlib_compress(data, data_len, out_len, quality, 1, 1);
+#endif // STBIW_ZLIB_COMPRESS
+}
+
+STBIWDEF unsigned char* stbi_zlib_compress_part(unsigned char* data, int data_len, int* out_len, int quality, int last)
+{
+#ifdef STBIW_ZLIB_COMPRESS
+    // a user provided compressor only writes whole streams
+    (void)data; (void)data_len; (void)out_len; (void)quality; (void)last;
+    return NULL;
+#else
+    return stbiw__zlib_compress(data, data_len, out_len, quality, 0, last);
 #endif // STBIW_ZLIB_COMPRESS
 }
 
@@ -1109,14 +1165,10 @@ static void stbiw__encode_png_line(unsigned char* pixels, int stride_bytes, int
     }
 }
 
-STBIWDEF unsigned char* stbi_write_png_to_mem(const unsigned char* pixels, int stride_bytes, int x, int y, int n, int* out_len)
+STBIWDEF void stbi_write_png_filter_rows(const unsigned char* pixels, int stride_bytes, int x, int y, int n, int row_begin, int row_end, int force_filter, unsigned char* out)
 {
-    int force_filter = stbi_write_force_png_filter;
-    int ctype[5] = { -1, 0, 4, 2, 6 };
-    unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
-    unsigned char* out, * o, * filt, * zlib;
     signed char* line_buffer;
-    int j, zlen;
+    int j;
 
     if (stride_bytes == 0)
         stride_bytes = x * n;
@@ -1125,10 +1177,11 @@ STBIWDEF unsigned char* stbi_write_png_to_mem(const unsigned char* pixels, int s
         force_filter = -1;
     }
 
-    filt = (unsigned char*)STBIW_MALLOC((x * n + 1) * y); if (!filt) return 0;
-    line_buffer = (signed char*)STBIW_MALLOC(x * n); if (!line_buffer) { STBIW_FREE(filt); return 0; }
-    for (j = 0; j < y; ++j) {
+    // each row is written after its filter byte, so it is filtered there directly
+    for (j = row_begin; j < row_end; ++j) {
         int filter_type;
+        unsigned char* filt = out + (j - row_begin) * (x * n + 1);
+        line_buffer = (signed char*)filt + 1;
         if (force_filter > -1) {
             filter_type = force_filter;
             stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, force_filter, line_buffer);
@@ -1154,10 +1207,19 @@ STBIWDEF unsigned char* stbi_write_png_to_mem(const unsigned char* pixels, int s
             }
         }
         // when we get here, filter_type contains the filter type, and line_buffer contains the data
-        filt[j * (x * n + 1)] = (unsigned char)filter_type;
-        STBIW_MEMMOVE(filt + j * (x * n + 1) + 1, line_buffer, x * n);
+        filt[0] = (unsigned char)filter_type;
     }
-    STBIW_FREE(line_buffer);
+}
+
+STBIWDEF unsigned char* stbi_write_png_to_mem(const unsigned char* pixels, int stride_bytes, int x, int y, int n, int* out_len)
+{
+    int ctype[5] = { -1, 0, 4, 2, 6 };
+    unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
+    unsigned char* out, * o, * filt, * zlib;
+    int zlen;
+
+    filt = (unsigned char*)STBIW_MALLOC((x * n + 1) * y); if (!filt) return 0;
+    stbi_write_png_filter_rows(pixels, stride_bytes, x, y, n, 0, y, stbi_write_force_png_filter, filt);
     zlib = stbi_zlib_compress(filt, y * (x * n + 1), &zlen, stbi_write_png_compression_level);
     STBIW_FREE(filt);
     if (!zlib) return 0;
@@ -1381,7 +1443,7 @@ static int stbiw__jpg_processDU(stbi__write_context* s, int* bitBuf, int* bitCnt
     return DU[0];
 }
 
-static int stbi_write_jpg_core(stbi__write_context* s, int width, int height, int comp, const void* data, int quality) {
+static int stbi_write_jpg_core(stbi__write_context* s, int width, int height, int comp, const void* data, int quality, int subsample_chroma) {
     // Constants that don't pollute global namespace
     static const unsigned char std_dc_luminance_nrcodes[] = { 0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
     static const unsigned char std_dc_luminance_values[] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
@@ -1462,7 +1524,7 @@ static int stbi_write_jpg_core(stbi__write_context* s, int width, int height, in
     }
 
     quality = quality ? quality : 90;
-    subsample = quality <= 90 ? 1 : 0;
+    subsample = subsample_chroma >= 0 ? subsample_chroma != 0 : quality <= 90 ? 1 : 0;
     quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
     quality = quality < 50 ? 5000 / quality : 200 - quality * 2;
 
@@ -1595,7 +1657,14 @@ STBIWDEF int stbi_write_jpg_to_func(stbi_write_func* func, void* context, int x,
 {
     stbi__write_context s = { 0 };
     stbi__start_write_callbacks(&s, func, context);
-    return stbi_write_jpg_core(&s, x, y, comp, (void*)data, quality);
+    return stbi_write_jpg_core(&s, x, y, comp, (void*)data, quality, -1);
+}
+
+STBIWDEF int stbi_write_jpg_to_func_subsampled(stbi_write_func* func, void* context, int x, int y, int comp, const void* data, int quality, int subsample)
+{
+    stbi__write_context s = { 0 };
+    stbi__start_write_callbacks(&s, func, context);
+    return stbi_write_jpg_core(&s, x, y, comp, (void*)data, quality, subsample);
 }
 
 
@@ -1604,7 +1673,7 @@ STBIWDEF int stbi_write_jpg(char const* filename, int x, int y, int comp, const
 {
     stbi__write_context s = { 0 };
     if (stbi__start_write_file(&s, filename)) {
-        int r = stbi_write_jpg_core(&s, x, y, comp, data, quality);
+        int r = stbi_write_jpg_core(&s, x, y, comp, data, quality, -1);
         stbi__end_write_file(&s);
         return r;
     }